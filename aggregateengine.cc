@@ -0,0 +1,214 @@
+#include "aggregateengine.h"
+#include "profiler.h"
+#include "sqlwriter.h"
+#include <QDebug>
+#include <QSqlError>
+
+AggregateEngine::AggregateEngine(const QSqlDatabase& db, const TreeInfo& tree_info)
+    : db { db }
+    , tree_info { tree_info }
+    , statements { db }
+{
+}
+
+double AggregateEngine::Total(int node, const QList<DimensionFilter>& filters)
+{
+    if (tree_info.transaction.isEmpty())
+        return 0.0;
+
+    QString key = QString::number(node);
+    for (const auto& filter : filters)
+        key += QString("|%1:%2").arg(filter.tree_info.node).arg(filter.node);
+
+    qint64 version = Version(filters);
+    auto it = cache.constFind(key);
+
+    if (it != cache.constEnd() && version >= 0 && it->version == version)
+        return it->total;
+
+    // Postings of the subtree through the ancestor index, each filter is a semi-join
+    // through the dimension primary key and the unique (ancestor, descendant) of its tree.
+    QString statement = QString("SELECT COALESCE(SUM(posting.amount), 0) FROM ("
+                                "SELECT t.id AS id, COALESCE(t.debit, 0) - COALESCE(t.credit, 0) AS amount "
+                                "FROM %1 p INNER JOIN %2 t ON t.source = p.descendant WHERE p.ancestor = :node "
+                                "UNION ALL "
+                                "SELECT t.id, COALESCE(t.credit, 0) - COALESCE(t.debit, 0) "
+                                "FROM %1 p INNER JOIN %2 t ON t.target = p.descendant WHERE p.ancestor = :node"
+                                ") posting")
+                            .arg(tree_info.node_path, tree_info.transaction);
+
+    for (int i = 0; i != filters.size(); ++i) {
+        statement += QString(i == 0 ? " WHERE " : " AND ");
+        statement += QString("EXISTS (SELECT 1 FROM %1_dimension d "
+                             "INNER JOIN %2 q ON q.descendant = d.node "
+                             "WHERE d.transaction_id = posting.id AND d.dimension = :dimension%3 AND q.ancestor = :filter%3)")
+                         .arg(tree_info.transaction, filters.at(i).tree_info.node_path)
+                         .arg(i);
+    }
+
+    auto& query = statements.Prepare(statement);
+    SqlTrace trace(query);
+
+    query.bindValue(":node", node);
+    for (int i = 0; i != filters.size(); ++i) {
+        query.bindValue(QString(":dimension%1").arg(i), filters.at(i).tree_info.node);
+        query.bindValue(QString(":filter%1").arg(i), filters.at(i).node);
+    }
+
+    if (!trace.Exec() || !trace.Next()) {
+        qWarning() << "Error query subtree total" << query.lastError().text();
+        return 0.0;
+    }
+
+    double total = query.value(0).toDouble();
+    query.finish();
+
+    if (version >= 0)
+        cache.insert(key, Entry { total, version });
+
+    return total;
+}
+
+double AggregateEngine::BalanceAt(int node, const QDate& date)
+{
+    if (tree_info.transaction.isEmpty() || !date.isValid())
+        return 0.0;
+
+    QString key = QString("%1@%2").arg(node).arg(date.toString(Qt::ISODate));
+
+    qint64 version = Version({});
+    auto it = cache.constFind(key);
+
+    if (it != cache.constEnd() && version >= 0 && it->version == version)
+        return it->total;
+
+    auto& query = statements.Prepare(QString("SELECT "
+                                             "(SELECT COALESCE(SUM(b.amount), 0) FROM %1 p "
+                                             "INNER JOIN %2_balance b ON b.account = p.descendant AND b.period < :period "
+                                             "WHERE p.ancestor = :node) "
+                                             "+ (SELECT COALESCE(SUM(COALESCE(t.debit, 0) - COALESCE(t.credit, 0)), 0) FROM %1 p "
+                                             "INNER JOIN %2 t ON t.source = p.descendant AND t.date >= :begin AND t.date <= :date "
+                                             "WHERE p.ancestor = :node) "
+                                             "+ (SELECT COALESCE(SUM(COALESCE(t.credit, 0) - COALESCE(t.debit, 0)), 0) FROM %1 p "
+                                             "INNER JOIN %2 t ON t.target = p.descendant AND t.date >= :begin AND t.date <= :date "
+                                             "WHERE p.ancestor = :node)")
+                                         .arg(tree_info.node_path, tree_info.transaction));
+    SqlTrace trace(query);
+
+    query.bindValue(":node", node);
+    query.bindValue(":period", date.toString("yyyy-MM"));
+    query.bindValue(":begin", QDate(date.year(), date.month(), 1).toString(Qt::ISODate));
+    query.bindValue(":date", date.toString(Qt::ISODate));
+
+    if (!trace.Exec() || !trace.Next()) {
+        qWarning() << "Error query subtree balance" << query.lastError().text();
+        return 0.0;
+    }
+
+    double total = query.value(0).toDouble();
+    query.finish();
+
+    if (version >= 0)
+        cache.insert(key, Entry { total, version });
+
+    return total;
+}
+
+QFuture<QVariant> AggregateEngine::Map(SqlWriter* writer, int transaction, const QString& dimension, int node)
+{
+    return writer->Submit([table = tree_info.transaction, transaction, dimension, node](const QSqlDatabase&, StatementCache& statements) {
+        auto& query = statements.Prepare(QString("INSERT OR IGNORE INTO %1_dimension (transaction_id, dimension, node) "
+                                                 "VALUES (:transaction, :dimension, :node)")
+                                             .arg(table));
+        SqlTrace trace(query);
+
+        query.bindValue(":transaction", transaction);
+        query.bindValue(":dimension", dimension);
+        query.bindValue(":node", node);
+
+        if (!trace.Exec()) {
+            qWarning() << "Failed to map transaction" << query.lastError().text();
+            return QVariant();
+        }
+
+        return QVariant(true);
+    });
+}
+
+QFuture<QVariant> AggregateEngine::Unmap(SqlWriter* writer, int transaction, const QString& dimension, int node)
+{
+    return writer->Submit([table = tree_info.transaction, transaction, dimension, node](const QSqlDatabase&, StatementCache& statements) {
+        auto& query = statements.Prepare(QString("DELETE FROM %1_dimension "
+                                                 "WHERE transaction_id = :transaction AND dimension = :dimension AND node = :node")
+                                             .arg(table));
+        SqlTrace trace(query);
+
+        query.bindValue(":transaction", transaction);
+        query.bindValue(":dimension", dimension);
+        query.bindValue(":node", node);
+
+        if (!trace.Exec()) {
+            qWarning() << "Failed to unmap transaction" << query.lastError().text();
+            return QVariant();
+        }
+
+        return QVariant(true);
+    });
+}
+
+QList<int> AggregateEngine::Mapped(int transaction, const QString& dimension)
+{
+    QList<int> nodes;
+
+    auto& query = statements.Prepare(QString("SELECT node FROM %1_dimension "
+                                             "WHERE transaction_id = :transaction AND dimension = :dimension")
+                                         .arg(tree_info.transaction));
+    SqlTrace trace(query);
+
+    query.bindValue(":transaction", transaction);
+    query.bindValue(":dimension", dimension);
+
+    if (!trace.Exec()) {
+        qWarning() << "Error query transaction dimension" << query.lastError().text();
+        return nodes;
+    }
+
+    while (trace.Next())
+        nodes << query.value(0).toInt();
+
+    return nodes;
+}
+
+void AggregateEngine::Invalidate()
+{
+    cache.clear();
+}
+
+qint64 AggregateEngine::Version(const QList<DimensionFilter>& filters)
+{
+    // Every version only grows, so the sum moves whenever one of them does.
+    QStringList names { tree_info.node, tree_info.transaction };
+    for (const auto& filter : filters)
+        names << filter.tree_info.node;
+
+    names.removeDuplicates();
+
+    QStringList placeholders;
+    for (int i = 0; i != names.size(); ++i)
+        placeholders << QString(":name%1").arg(i);
+
+    auto& query = statements.Prepare(QString("SELECT COALESCE(SUM(version), -1) FROM tree_version WHERE name IN (%1)")
+                                         .arg(placeholders.join(", ")));
+    SqlTrace trace(query);
+
+    for (int i = 0; i != names.size(); ++i)
+        query.bindValue(placeholders.at(i), names.at(i));
+
+    if (!trace.Exec() || !trace.Next())
+        return -1;
+
+    qint64 version = query.value(0).toLongLong();
+    query.finish();
+
+    return version;
+}
@@ -0,0 +1,59 @@
+#ifndef AGGREGATEENGINE_H
+#define AGGREGATEENGINE_H
+
+#include "statementcache.h"
+#include "tree.h"
+#include <QDate>
+#include <QFuture>
+#include <QHash>
+#include <QSqlDatabase>
+#include <QVariant>
+
+class SqlWriter;
+
+// Restricts a total to the transactions mapped to one subtree of another tree.
+struct DimensionFilter {
+    TreeInfo tree_info;
+    int node { 0 };
+};
+
+// Answers "net amount of subtree X of tree A, limited to subtree Y of tree B" from the
+// closure tables and the transaction dimension table, one indexed query per question.
+// Results are cached until the version of any involved tree or of the transactions moves.
+
+class AggregateEngine {
+public:
+    AggregateEngine(const QSqlDatabase& db, const TreeInfo& tree_info);
+
+    // Sum of debit - credit posted from the subtree plus credit - debit posted into it.
+    double Total(int node, const QList<DimensionFilter>& filters = {});
+
+    // Net amount of the subtree up to and including date: monthly balances of the earlier
+    // months plus the transactions of date's own month.
+    double BalanceAt(int node, const QDate& date);
+
+    // Queued on writer, the engine's own connection only reads. The result is invalid when
+    // the write failed.
+    QFuture<QVariant> Map(SqlWriter* writer, int transaction, const QString& dimension, int node);
+    QFuture<QVariant> Unmap(SqlWriter* writer, int transaction, const QString& dimension, int node);
+    QList<int> Mapped(int transaction, const QString& dimension);
+
+    void Invalidate();
+
+private:
+    qint64 Version(const QList<DimensionFilter>& filters);
+
+private:
+    struct Entry {
+        double total { 0.0 };
+        qint64 version { -1 };
+    };
+
+    QSqlDatabase db;
+    TreeInfo tree_info;
+    StatementCache statements;
+
+    QHash<QString, Entry> cache;
+};
+
+#endif // AGGREGATEENGINE_H
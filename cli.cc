@@ -0,0 +1,463 @@
+#include "aggregateengine.h"
+#include "closurechecker.h"
+#include "closurestore.h"
+#include "connectionmanager.h"
+#include "importer.h"
+#include "profiler.h"
+#include "reportengine.h"
+#include "schema.h"
+#include "sqlconnection.h"
+#include "sqlwriter.h"
+#include "stringinterner.h"
+#include "treeloader.h"
+#include "treemodel.h"
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QMimeData>
+#include <QRandomGenerator>
+#include <QSqlError>
+#include <QTextStream>
+#include <QThreadPool>
+#include <algorithm>
+#include <memory>
+
+#ifdef TREEMODEL_MODEL_TESTER
+#include <QAbstractItemModelTester>
+#endif
+
+// Headless driver for scripted load tests, e.g.
+//   treecli test.db load
+//   treecli test.db load 2
+//   treecli --tree project test.db insert 0 10000
+//   treecli test.db insert-batch 0 100000 "Account %1"
+//   treecli test.db insert-model 0 100000 "Account %1"
+//   treecli test.db stress 1000000 42
+//   TREEMODEL_TRACE=trace.json treecli test.db report balance.csv 2024-12-31
+//   treecli test.db total 12 cost_centre:4
+//   treecli test.db balance 12 2024-06-30
+
+namespace {
+QTextStream& Out()
+{
+    static QTextStream stream(stdout);
+    return stream;
+}
+
+void Report(const QString& command, int operations, qint64 elapsed)
+{
+    double seconds = qMax<qint64>(elapsed, 1) / 1000.0;
+    Out() << command << ": " << operations << " ops in " << elapsed << " ms ("
+          << qRound64(operations / seconds) << " ops/s)" << Qt::endl;
+}
+
+// A random walk down from the root that stops at every level with a chance of one in three,
+// so shallow and deep rows are both picked. Invalid (the root) when the walk stops at once.
+QModelIndex RandomIndex(const QAbstractItemModel& model, QRandomGenerator& random)
+{
+    QModelIndex index;
+
+    while (true) {
+        int rows = model.rowCount(index);
+        if (rows == 0 || (index.isValid() && random.bounded(3) == 0))
+            return index;
+
+        index = model.index(random.bounded(rows), 0, index);
+    }
+}
+
+// The index of a loaded node, invalid for the root and for ids that are not in the graph.
+QModelIndex IndexOf(const TreeModel& model, int id)
+{
+    std::function<const Node*(const Node*)> Find = [id, &Find](const Node* node) -> const Node* {
+        if (node->id == id)
+            return node;
+
+        for (const Node* child : node->children) {
+            if (const Node* found = Find(child))
+                return found;
+        }
+
+        return nullptr;
+    };
+
+    QList<int> rows;
+    for (const Node* node = Find(model.GetRoot()); node && node->parent; node = node->parent)
+        rows.prepend(node->parent->children.indexOf(node));
+
+    QModelIndex index;
+    for (int row : qAsConst(rows))
+        index = model.index(row, 0, index);
+
+    return index;
+}
+
+// Random inserts, removes, moves, drops, renames and sorts through the public TreeModel API,
+// the way views drive it. After every batch the writer is drained, the continuations run and the
+// closure table is checked against itself and against the in-memory graph. Rejected edits
+// (a move under its own subtree, say) are expected, failed writes and violations are not.
+int Stress(QSqlDatabase& db, ConnectionManager& connections, const TreeInfo& tree_info, int operations, quint32 seed, int batch)
+{
+    StringInterner interner;
+    TreeModel model(db, tree_info, TreeLoader::Load(db, tree_info, &interner), &interner, nullptr, connections.Writer());
+
+#ifdef TREEMODEL_MODEL_TESTER
+    // Checks every signal against the model's structure, slow but exact.
+    QAbstractItemModelTester tester(&model, QAbstractItemModelTester::FailureReportingMode::Fatal);
+#endif
+
+    QRandomGenerator random(seed);
+    ClosureChecker checker(db, tree_info);
+
+    int rejected = 0;
+    int failed = 0;
+    qint64 mutating = 0;
+    qint64 checking = 0;
+    QElapsedTimer timer;
+
+    auto Count = [&failed](bool committed) {
+        if (!committed)
+            ++failed;
+    };
+
+    QList<QFuture<void>> counted;
+
+    for (int done = 0; done < operations;) {
+        timer.start();
+
+        for (int end = qMin(done + batch, operations); done != end; ++done) {
+            int operation = random.bounded(100);
+            QModelIndex index = RandomIndex(model, random);
+
+            if (operation < 35) {
+                auto names = ClosureStore::NumberedNames("Stress %1", 1 + random.bounded(3), done);
+                auto future = model.InsertChildren(index, names, random.bounded(model.rowCount(index) + 1));
+
+                if (future.isCanceled())
+                    ++rejected;
+                else
+                    counted << future.then([&Count](int first) { Count(first != 0); });
+
+                continue;
+            }
+
+            QFuture<bool> future;
+
+            if (operation < 55 && index.isValid()) {
+                future = model.Remove(index);
+            } else if (operation < 70 && index.isValid()) {
+                future = model.Move(index, RandomIndex(model, random));
+            } else if (operation < 80 && index.isValid()) {
+                // An internal drag as QTreeView runs it: the drop, then clearOrRemove() on the
+                // dragged row once the drop reports a move. The model moves the row itself and
+                // must not report one, else the view would delete the node it just moved.
+                QPersistentModelIndex dragged(index);
+                std::unique_ptr<QMimeData> data(model.mimeData({ index }));
+
+                if (model.dropMimeData(data.get(), Qt::MoveAction, -1, 0, RandomIndex(model, random))) {
+                    Out() << "stress: drop of " << model.data(dragged).toString() << " reported as a move" << Qt::endl;
+                    ++failed;
+
+                    if (dragged.isValid())
+                        model.removeRows(dragged.row(), 1, dragged.parent());
+                }
+
+                continue;
+            } else if (operation < 99 && index.isValid()) {
+                future = model.Update(index, QString("Renamed %1").arg(done));
+            } else {
+                // A sort, or the walk picked the root.
+                if (operation == 99)
+                    model.sort(random.bounded(model.columnCount()), random.bounded(2) ? Qt::AscendingOrder : Qt::DescendingOrder);
+
+                continue;
+            }
+
+            if (future.isCanceled())
+                ++rejected;
+            else
+                counted << future.then(Count);
+        }
+
+        // Each continuation queues the next one, so events are processed until every edit
+        // reported back and the model has no write of its own left in flight.
+        connections.Writer()->Flush();
+
+        auto Settled = [&model, &counted]() {
+            return !model.PendingWrites()
+                && std::all_of(counted.cbegin(), counted.cend(), [](const QFuture<void>& future) { return future.isFinished(); });
+        };
+
+        while (!Settled())
+            QCoreApplication::processEvents();
+
+        counted.clear();
+        mutating += timer.elapsed();
+
+        timer.start();
+        auto violations = checker.Check(model.GetRoot());
+        checking += timer.elapsed();
+
+        for (const auto& violation : qAsConst(violations))
+            Out() << ClosureChecker::Describe(violation) << Qt::endl;
+
+        if (!violations.isEmpty() || failed) {
+            Out() << "stress: failed after " << done << " ops, seed " << seed << ", " << failed << " failed writes" << Qt::endl;
+            return 1;
+        }
+    }
+
+    Report("stress", operations, mutating);
+    Out() << rejected << " rejected, checked in " << checking << " ms, "
+          << model.GetLeafPaths().Size() << " leaves" << Qt::endl;
+
+    return 0;
+}
+
+int Run(QSqlDatabase& db, ConnectionManager& connections, const TreeInfo& tree_info, const QStringList& arguments)
+{
+    const QString command = arguments.value(0);
+    QElapsedTimer timer;
+    timer.start();
+
+    if (command == "load") {
+        // With a depth only the top levels are built, as for the summary view.
+        int depth = arguments.value(1).toInt();
+        TreeData data = depth > 0 ? TreeLoader::LoadLevels(db, tree_info, depth) : TreeLoader::Load(db, tree_info);
+        Report(command, 1, timer.elapsed());
+        Out() << data.node_hash.size() << " nodes, " << data.hidden.size() << " collapsed, "
+              << data.leaf_paths.Size() << " leaves" << Qt::endl;
+
+        bool result = data.root;
+        delete data.root;
+        return result ? 0 : 1;
+    }
+
+    if (command == "insert" && arguments.size() == 3) {
+        // Queued on the writer like model edits, so the count includes group commit.
+        int parent = arguments.at(1).toInt();
+        int count = arguments.at(2).toInt();
+        QList<QFuture<QVariant>> futures;
+
+        for (int i = 0; i != count; ++i) {
+            futures << connections.Writer()->Submit([tree_info, parent, i](const QSqlDatabase& db, StatementCache& statements) {
+                int id = ClosureStore(db, tree_info, &statements).Insert(parent, QString("Node %1").arg(i));
+                return id ? QVariant(id) : QVariant();
+            });
+        }
+
+        connections.Writer()->Flush();
+        Report(command, count, timer.elapsed());
+
+        bool result = std::all_of(futures.cbegin(), futures.cend(), [](const QFuture<QVariant>& future) { return future.result().isValid(); });
+        return result ? 0 : 1;
+    }
+
+    if (command == "insert-batch" && arguments.size() >= 3) {
+        // The same children as insert, written by one job with set based statements.
+        int parent = arguments.at(1).toInt();
+        int count = arguments.at(2).toInt();
+        auto names = ClosureStore::NumberedNames(arguments.value(3, "Node %1"), count, 0);
+
+        auto future = connections.Writer()->Submit([tree_info, parent, names](const QSqlDatabase& db, StatementCache& statements) {
+            int first = ClosureStore(db, tree_info, &statements).InsertChildren(parent, names);
+            return first ? QVariant(first) : QVariant();
+        });
+
+        connections.Writer()->Flush();
+        Report(command, count, timer.elapsed());
+
+        return future.result().isValid() ? 0 : 1;
+    }
+
+    if (command == "insert-model" && arguments.size() >= 3) {
+        // The same children through TreeModel::InsertChildren, as a view adds them: the nodes
+        // in memory, one writer job, the leaf path patch and the continuation that reports the
+        // commit. Loading the model is not counted.
+        StringInterner interner;
+        TreeModel model(db, tree_info, TreeLoader::Load(db, tree_info, &interner), &interner, nullptr, connections.Writer());
+
+        int parent = arguments.at(1).toInt();
+        int count = arguments.at(2).toInt();
+        auto names = ClosureStore::NumberedNames(arguments.value(3, "Node %1"), count, 0);
+
+        QModelIndex index = IndexOf(model, parent);
+        if (parent > 0 && !index.isValid()) {
+            Out() << "insert-model: node " << parent << " is not in the tree" << Qt::endl;
+            return 1;
+        }
+
+        timer.start();
+        auto future = model.InsertChildren(index, names);
+        if (future.isCanceled())
+            return 1;
+
+        qint64 shown = timer.elapsed();
+
+        connections.Writer()->Flush();
+        while (!future.isFinished())
+            QCoreApplication::processEvents();
+
+        Report(command, count, timer.elapsed());
+        Out() << "shown after " << shown << " ms" << Qt::endl;
+
+        return future.result() ? 0 : 1;
+    }
+
+    if ((command == "move" || command == "copy") && arguments.size() == 3) {
+        ClosureStore store(db, tree_info);
+        int id = arguments.at(1).toInt();
+        int parent = arguments.at(2).toInt();
+        bool result = command == "move" ? store.Move(id, parent) : store.Copy(id, parent) != 0;
+
+        Report(command, 1, timer.elapsed());
+        return result ? 0 : 1;
+    }
+
+    if (command == "remove" && arguments.size() == 2) {
+        bool result = ClosureStore(db, tree_info).Remove(arguments.at(1).toInt());
+
+        Report(command, 1, timer.elapsed());
+        return result ? 0 : 1;
+    }
+
+    if (command == "stress" && arguments.size() >= 2) {
+        quint32 seed = arguments.size() >= 3 ? arguments.at(2).toUInt() : QRandomGenerator::global()->generate();
+        int batch = qMax(arguments.value(3, "1000").toInt(), 1);
+
+        return Stress(db, connections, tree_info, arguments.at(1).toInt(), seed, batch);
+    }
+
+    if (command == "check") {
+        TreeData data = TreeLoader::Load(db, tree_info);
+        auto violations = ClosureChecker(db, tree_info).Check(data.root);
+        Report(command, 1, timer.elapsed());
+
+        for (const auto& violation : qAsConst(violations))
+            Out() << ClosureChecker::Describe(violation) << Qt::endl;
+
+        delete data.root;
+        return violations.isEmpty() ? 0 : 1;
+    }
+
+    if (command == "report" && arguments.size() >= 2) {
+        TreeData data = TreeLoader::Load(db, tree_info);
+        QThreadPool pool;
+        auto rows = ReportEngine::TrialBalance(&connections, tree_info, ReportEngine::Flatten(data.root),
+            QDate::fromString(arguments.value(2), Qt::ISODate), &pool);
+        Report(command, rows.size(), timer.elapsed());
+
+        delete data.root;
+        return ReportEngine::ExportCsv(arguments.at(1), rows) ? 0 : 1;
+    }
+
+    if (command == "total" && arguments.size() >= 2) {
+        // Every further argument limits the total to a subtree of another tree, as tree:node.
+        QList<DimensionFilter> filters;
+
+        for (const auto& argument : arguments.mid(2)) {
+            auto parts = argument.split(':');
+            if (parts.size() != 2 || parts.at(1).toInt() <= 0) {
+                qWarning() << "Expected tree:node, got" << argument;
+                return 2;
+            }
+
+            filters << DimensionFilter { TreeInfo(parts.at(0), parts.at(0) + "_path"), parts.at(1).toInt() };
+        }
+
+        double total = AggregateEngine(db, tree_info).Total(arguments.at(1).toInt(), filters);
+        Report(command, 1, timer.elapsed());
+        Out() << QString::number(total, 'f', 2) << Qt::endl;
+        return 0;
+    }
+
+    if (command == "balance" && arguments.size() == 3) {
+        auto date = QDate::fromString(arguments.at(2), Qt::ISODate);
+        if (!date.isValid()) {
+            qWarning() << "Expected an ISO date, got" << arguments.at(2);
+            return 2;
+        }
+
+        double balance = AggregateEngine(db, tree_info).BalanceAt(arguments.at(1).toInt(), date);
+        Report(command, 1, timer.elapsed());
+        Out() << QString::number(balance, 'f', 2) << Qt::endl;
+        return 0;
+    }
+
+    if ((command == "import-accounts" || command == "import-transactions") && arguments.size() == 2) {
+        Importer importer(db, tree_info);
+        bool result = command == "import-accounts" ? importer.ImportAccounts(arguments.at(1))
+                                                   : importer.ImportTransactions(arguments.at(1));
+
+        Report(command, 1, timer.elapsed());
+        return result ? 0 : 1;
+    }
+
+    qWarning() << "Unknown command or wrong arguments:" << arguments.join(' ');
+    return 2;
+}
+}
+
+int main(int argc, char* argv[])
+{
+    QCoreApplication app(argc, argv);
+    Profiler::Enable(qEnvironmentVariable("TREEMODEL_TRACE"));
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Runs tree operations against a database without the user interface.");
+    parser.addHelpOption();
+    parser.addOption({ "tree", "Tree to operate on: financial, cost_centre or project.", "name", "financial" });
+    parser.addPositionalArgument("database", "SQLite database file.");
+    parser.addPositionalArgument("command",
+        "load [depth] | insert <parent> <count> | insert-batch <parent> <count> [pattern] | insert-model <parent> <count> [pattern] "
+        "| move <id> <parent> | copy <id> <parent> | remove <id> | check | stress <ops> [seed] [batch] "
+        "| report <csv> [date] | total <id> [tree:id...] | balance <id> <date> | import-accounts <csv> | import-transactions <csv>");
+    parser.process(app);
+
+    auto arguments = parser.positionalArguments();
+    if (arguments.size() < 2)
+        parser.showHelp(2);
+
+    auto tree_infos = QList<TreeInfo> {
+        TreeInfo("financial", "financial_path", "financial_transaction"),
+        TreeInfo("cost_centre", "cost_centre_path"),
+        TreeInfo("project", "project_path"),
+    };
+
+    auto tree_info = std::find_if(tree_infos.begin(), tree_infos.end(),
+        [&parser](const TreeInfo& tree_info) { return tree_info.node == parser.value("tree"); });
+    if (tree_info == tree_infos.end()) {
+        qWarning() << "Unknown tree" << parser.value("tree");
+        return 2;
+    }
+
+    int result = 1;
+
+    {
+        auto db = QSqlDatabase::addDatabase("QSQLITE");
+        db.setDatabaseName(arguments.takeFirst());
+
+        if (!db.open()) {
+            qWarning() << "Failed to open database:" << db.lastError().text();
+            return 1;
+        }
+
+        SqlConnection::ApplyProfile(db);
+
+        for (auto& info : tree_infos)
+            Schema::Migrate(db, info);
+
+        {
+            ConnectionManager connections(db);
+            result = Run(db, connections, *tree_info, arguments);
+        }
+
+        db.close();
+    }
+
+    QSqlDatabase::removeDatabase(QSqlDatabase::defaultConnection);
+    Profiler::Write();
+    return result;
+}
@@ -0,0 +1,266 @@
+#include "closurechecker.h"
+#include "profiler.h"
+#include "schema.h"
+#include <QDebug>
+#include <QSqlError>
+#include <QSqlQuery>
+
+namespace {
+const int kBatchSize = 50000;
+}
+
+ClosureChecker::ClosureChecker(const QSqlDatabase& db, const TreeInfo& tree_info)
+    : db { db }
+    , tree_info { tree_info }
+{
+}
+
+QList<ClosureViolation> ClosureChecker::Check(const Node* root)
+{
+    QList<ClosureViolation> violations;
+
+    if (!LoadParents(violations))
+        return violations;
+
+    auto query = QSqlQuery(db);
+    SqlTrace trace(query);
+    query.setForwardOnly(true);
+
+    // Grouped by descendant through the descendant index, no sort step.
+    query.prepare(QString("SELECT descendant, ancestor, distance FROM %1 ORDER BY descendant").arg(tree_info.node_path));
+    if (!trace.Exec()) {
+        qWarning() << "Error query data from node path" << query.lastError().text();
+        return violations;
+    }
+
+    QSet<int> seen;
+    seen.reserve(nodes.size());
+
+    QHash<int, int> rows;
+    int current = 0;
+    bool pending = false;
+
+    auto Verify = [this, &violations, &rows](int descendant) {
+        if (!nodes.contains(descendant)) {
+            rows.clear();
+            return;
+        }
+
+        int distance = 0;
+
+        for (int ancestor = descendant; ancestor; ancestor = parents.value(ancestor), ++distance) {
+            auto it = rows.find(ancestor);
+
+            if (it == rows.end()) {
+                violations << ClosureViolation { ancestor == descendant ? ClosureViolation::kMissingSelf : ClosureViolation::kMissingPath, ancestor, descendant };
+                continue;
+            }
+
+            if (*it != distance)
+                violations << ClosureViolation { ClosureViolation::kWrongDistance, ancestor, descendant };
+
+            rows.erase(it);
+        }
+
+        for (auto it = rows.cbegin(); it != rows.cend(); ++it)
+            violations << ClosureViolation { ClosureViolation::kExtraPath, it.key(), descendant };
+
+        rows.clear();
+    };
+
+    while (trace.Next()) {
+        int descendant = query.value(0).toInt();
+        int ancestor = query.value(1).toInt();
+
+        if (pending && descendant != current) {
+            Verify(current);
+            seen.insert(current);
+        }
+
+        current = descendant;
+        pending = true;
+
+        if (!nodes.contains(descendant) || !nodes.contains(ancestor)) {
+            violations << ClosureViolation { ClosureViolation::kDangling, ancestor, descendant };
+            continue;
+        }
+
+        rows.insert(ancestor, query.value(2).toInt());
+    }
+
+    if (pending) {
+        Verify(current);
+        seen.insert(current);
+    }
+
+    for (int id : qAsConst(nodes)) {
+        if (!seen.contains(id))
+            Verify(id);
+    }
+
+    if (root) {
+        std::function<void(const Node*)> Compare = [this, root, &violations, &Compare](const Node* node) {
+            for (const Node* child : node->children) {
+                int parent = node == root ? 0 : node->id;
+
+                if (parents.value(child->id) != parent)
+                    violations << ClosureViolation { ClosureViolation::kModelMismatch, parent, child->id };
+
+                Compare(child);
+            }
+        };
+        Compare(root);
+    }
+
+    return violations;
+}
+
+bool ClosureChecker::LoadParents(QList<ClosureViolation>& violations)
+{
+    nodes.clear();
+    parents.clear();
+
+    auto query = QSqlQuery(db);
+    SqlTrace trace(query);
+    query.setForwardOnly(true);
+
+    query.prepare(QString("SELECT id FROM %1").arg(tree_info.node));
+    if (!trace.Exec()) {
+        qWarning() << "Error query data from node" << query.lastError().text();
+        return false;
+    }
+
+    while (trace.Next())
+        nodes.insert(query.value(0).toInt());
+
+    query.prepare(QString("SELECT ancestor, descendant FROM %1 WHERE distance = 1 ORDER BY descendant, ancestor").arg(tree_info.node_path));
+    if (!trace.Exec()) {
+        qWarning() << "Error query data from node path" << query.lastError().text();
+        return false;
+    }
+
+    while (trace.Next()) {
+        int ancestor = query.value(0).toInt();
+        int descendant = query.value(1).toInt();
+
+        if (!nodes.contains(ancestor) || !nodes.contains(descendant))
+            continue;
+
+        // The lowest ancestor wins, the others are reported and dropped by Rebuild().
+        if (parents.contains(descendant)) {
+            violations << ClosureViolation { ClosureViolation::kMultipleParents, ancestor, descendant };
+            continue;
+        }
+
+        parents.insert(descendant, ancestor);
+    }
+
+    // Colour walk over the parent pointers, every node is entered once. The edge that
+    // closes a cycle is dropped so the chains walked afterwards terminate.
+    QHash<int, int> state; // 1 on the current walk, 2 finished
+    state.reserve(nodes.size());
+
+    for (int id : qAsConst(nodes)) {
+        QList<int> walk;
+
+        for (int node = id; node && !state.contains(node); node = parents.value(node)) {
+            state.insert(node, 1);
+            walk << node;
+
+            int parent = parents.value(node);
+            if (parent && state.value(parent) == 1) {
+                violations << ClosureViolation { ClosureViolation::kCycle, parent, node };
+                parents.remove(node);
+                break;
+            }
+        }
+
+        for (int node : qAsConst(walk))
+            state[node] = 2;
+    }
+
+    return true;
+}
+
+bool ClosureChecker::Rebuild()
+{
+    QList<ClosureViolation> violations;
+
+    bool result = LoadParents(violations) && Schema::DropIndexes(db, tree_info) && Schema::DropTriggers(db, tree_info);
+
+    auto query = QSqlQuery(db);
+    SqlTrace trace(query);
+
+    if (result) {
+        query.prepare(QString("DELETE FROM %1").arg(tree_info.node_path));
+        result = trace.Exec();
+    }
+
+    QVariantList ancestors;
+    QVariantList descendants;
+    QVariantList distances;
+
+    auto Flush = [&]() {
+        if (ancestors.isEmpty())
+            return true;
+
+        query.prepare(QString("INSERT INTO %1 (ancestor, descendant, distance) VALUES (?, ?, ?)").arg(tree_info.node_path));
+        query.addBindValue(ancestors);
+        query.addBindValue(descendants);
+        query.addBindValue(distances);
+
+        bool flushed = trace.ExecBatch();
+
+        ancestors.clear();
+        descendants.clear();
+        distances.clear();
+
+        return flushed;
+    };
+
+    for (auto it = nodes.cbegin(); result && it != nodes.cend(); ++it) {
+        int distance = 0;
+
+        for (int ancestor = *it; ancestor; ancestor = parents.value(ancestor), ++distance) {
+            ancestors << ancestor;
+            descendants << *it;
+            distances << distance;
+        }
+
+        if (ancestors.size() >= kBatchSize)
+            result = Flush();
+    }
+
+    result = result && Flush()
+        && Schema::CreateIndexes(db, tree_info) && Schema::CreateTriggers(db, tree_info)
+        && Schema::Touch(db, tree_info.node);
+
+    if (!result)
+        qWarning() << "Closure rebuild failed" << query.lastError().text() << db.lastError().text();
+
+    return result;
+}
+
+QString ClosureChecker::Describe(const ClosureViolation& violation)
+{
+    switch (violation.kind) {
+    case ClosureViolation::kMissingSelf:
+        return QString("%1 has no self row").arg(violation.descendant);
+    case ClosureViolation::kMissingPath:
+        return QString("%1 is missing ancestor %2").arg(violation.descendant).arg(violation.ancestor);
+    case ClosureViolation::kWrongDistance:
+        return QString("%1 has a wrong distance to ancestor %2").arg(violation.descendant).arg(violation.ancestor);
+    case ClosureViolation::kExtraPath:
+        return QString("%1 lists %2 as ancestor, which is not on its parent chain").arg(violation.descendant).arg(violation.ancestor);
+    case ClosureViolation::kMultipleParents:
+        return QString("%1 has an extra parent %2").arg(violation.descendant).arg(violation.ancestor);
+    case ClosureViolation::kCycle:
+        return QString("%1 and its parent %2 form a cycle").arg(violation.descendant).arg(violation.ancestor);
+    case ClosureViolation::kDangling:
+        return QString("row (%1, %2) references a missing node").arg(violation.ancestor).arg(violation.descendant);
+    case ClosureViolation::kModelMismatch:
+        return QString("%1 is shown under %2, the database disagrees").arg(violation.descendant).arg(violation.ancestor);
+    }
+
+    return QString();
+}
@@ -0,0 +1,52 @@
+#ifndef CLOSURECHECKER_H
+#define CLOSURECHECKER_H
+
+#include "tree.h"
+#include <QHash>
+#include <QSet>
+#include <QSqlDatabase>
+
+struct ClosureViolation {
+    enum Kind {
+        kMissingSelf, // no (id, id, 0) row
+        kMissingPath, // an ancestor on the parent chain has no row
+        kWrongDistance, // row exists with a distance that does not match the parent chain
+        kExtraPath, // row whose ancestor is not on the parent chain
+        kMultipleParents, // more than one distance 1 row for a descendant
+        kCycle, // the parent chain returns to the node
+        kDangling, // row references a node that does not exist
+        kModelMismatch, // the in-memory parent differs from the database
+    };
+
+    Kind kind;
+    int ancestor { 0 };
+    int descendant { 0 };
+};
+
+// Verifies the closure table of one tree against its own distance 1 rows and optionally
+// against the in-memory graph of a model. Every node's parent chain is walked once against
+// that node's rows, so a check is linear in the size of the closure table.
+// Rebuild() regenerates the closure table from the parent relation. It runs as a writer job,
+// inside the writer's transaction, which rolls it back as a whole when it fails.
+
+class ClosureChecker {
+public:
+    ClosureChecker(const QSqlDatabase& db, const TreeInfo& tree_info);
+
+    QList<ClosureViolation> Check(const Node* root = nullptr);
+    bool Rebuild();
+
+    static QString Describe(const ClosureViolation& violation);
+
+private:
+    bool LoadParents(QList<ClosureViolation>& violations);
+
+private:
+    QSqlDatabase db;
+    TreeInfo tree_info;
+
+    QSet<int> nodes;
+    QHash<int, int> parents; // descendant -> ancestor at distance 1, cycles already broken
+};
+
+#endif // CLOSURECHECKER_H
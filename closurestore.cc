@@ -0,0 +1,425 @@
+#include "closurestore.h"
+#include "profiler.h"
+#include "schema.h"
+#include "sqlconnection.h"
+#include "statementcache.h"
+#include <QDebug>
+#include <QSqlError>
+#include <QSqlQuery>
+
+namespace {
+// Rows per multi-row INSERT, two variables each stay below SQLite's old limit of 999.
+const int kInsertChunk = 400;
+}
+
+ClosureStore::ClosureStore(const QSqlDatabase& db, const TreeInfo& tree_info, StatementCache* statements)
+    : db { db }
+    , tree_info { tree_info }
+    , statements { statements }
+{
+    if (!statements) {
+        own_statements = std::make_unique<StatementCache>(db);
+        this->statements = own_statements.get();
+    }
+}
+
+ClosureStore::~ClosureStore() = default;
+
+int ClosureStore::Insert(int parent, const QString& name)
+{
+    if (!Begin())
+        return 0;
+
+    auto& node_query = statements->Prepare(QString("INSERT INTO %1 (name) VALUES (:name)").arg(tree_info.node));
+    SqlTrace node_trace(node_query);
+
+    node_query.bindValue(":name", name);
+
+    if (!node_trace.Exec()) {
+        qWarning() << "Failed to add node" << node_query.lastError().text();
+        Rollback();
+        return 0;
+    }
+
+    int id = node_query.lastInsertId().toInt();
+
+    auto& path_query = statements->Prepare(QString(
+        "INSERT INTO %1 (ancestor, descendant, distance) "
+        "SELECT ancestor, :id, distance + 1 "
+        "FROM %1 WHERE descendant = :parent "
+        "UNION ALL SELECT :id, :id, 0")
+                                               .arg(tree_info.node_path));
+    SqlTrace path_trace(path_query);
+
+    path_query.bindValue(":id", id);
+    path_query.bindValue(":parent", parent);
+
+    if (!path_trace.Exec()) {
+        qWarning() << "Failed to add node_path"
+                   << path_query.lastError().text();
+        Rollback();
+        return 0;
+    }
+
+    return Commit() ? id : 0;
+}
+
+int ClosureStore::InsertChildren(int parent, const QStringList& names, int first)
+{
+    if (names.isEmpty() || !Begin())
+        return 0;
+
+    auto Fail = [this](const QSqlQuery& query, const char* step) {
+        qWarning() << "Failed to add nodes" << step << query.lastError().text();
+        Rollback();
+        return 0;
+    };
+
+    if (!first)
+        first = NextId();
+
+    if (!first) {
+        Rollback();
+        return 0;
+    }
+
+    int last = first + names.size() - 1;
+
+    // Explicit ids keep the batch contiguous, the closure rows below select it as a range.
+    for (int from = 0; from < names.size(); from += kInsertChunk) {
+        int rows = qMin(kInsertChunk, int(names.size()) - from);
+        auto sql = QString("INSERT INTO %1 (id, name) VALUES %2").arg(tree_info.node, QStringList(rows, "(?, ?)").join(", "));
+
+        // Only full chunks are worth caching, the odd sized tail runs once.
+        QSqlQuery tail(db);
+        if (rows != kInsertChunk)
+            tail.prepare(sql);
+
+        auto& node_query = rows == kInsertChunk ? statements->Prepare(sql) : tail;
+        SqlTrace node_trace(node_query);
+
+        for (int i = 0; i != rows; ++i) {
+            node_query.bindValue(2 * i, first + from + i);
+            node_query.bindValue(2 * i + 1, names.at(from + i));
+        }
+
+        if (!node_trace.Exec())
+            return Fail(node_query, "node");
+    }
+
+    auto& path_query = statements->Prepare(QString("INSERT INTO %1 (ancestor, descendant, distance) "
+                                                   "SELECT p.ancestor, n.id, p.distance + 1 FROM %1 p "
+                                                   "CROSS JOIN %2 n "
+                                                   "WHERE p.descendant = :parent AND n.id BETWEEN :first AND :last "
+                                                   "UNION ALL SELECT id, id, 0 FROM %2 WHERE id BETWEEN :first AND :last")
+                                               .arg(tree_info.node_path, tree_info.node));
+    SqlTrace path_trace(path_query);
+
+    path_query.bindValue(":parent", parent);
+    path_query.bindValue(":first", first);
+    path_query.bindValue(":last", last);
+
+    if (!path_trace.Exec())
+        return Fail(path_query, "node_path");
+
+    return Commit() ? first : 0;
+}
+
+bool ClosureStore::Update(int id, const QString& column, const QVariant& value)
+{
+    auto& query = statements->Prepare(QString("UPDATE %1 SET %2 = :value WHERE id = :id").arg(tree_info.node, column));
+    SqlTrace trace(query);
+
+    query.bindValue(":id", id);
+    query.bindValue(":value", value);
+
+    if (!trace.Exec()) {
+        qWarning() << "Failed to edit record:" << query.lastError().text();
+        return false;
+    }
+    return true;
+}
+
+bool ClosureStore::Remove(int id)
+{
+    if (!Begin())
+        return false;
+
+    auto& node_query = statements->Prepare(QString("DELETE FROM %1 WHERE id = :id").arg(tree_info.node));
+    SqlTrace node_trace(node_query);
+
+    node_query.bindValue(":id", id);
+    if (!node_trace.Exec()) {
+        qWarning() << "Failed to remove node 1st step" << node_query.lastError().text();
+        Rollback();
+        return false;
+    }
+
+    auto& distance_query = statements->Prepare(QString(
+        "UPDATE %1 SET distance = distance -1 WHERE "
+        "(descendant IN (SELECT descendant FROM %1 WHERE ancestor = :id AND ancestor != descendant) "
+        "AND ancestor IN (SELECT ancestor FROM %1 WHERE descendant = :id AND ancestor != descendant))")
+                                                   .arg(tree_info.node_path));
+    SqlTrace distance_trace(distance_query);
+
+    distance_query.bindValue(":id", id);
+    if (!distance_trace.Exec()) {
+        qWarning() << "Failed to remove node_path 2nd step"
+                   << distance_query.lastError().text();
+        Rollback();
+        return false;
+    }
+
+    auto& path_query = statements->Prepare(QString(
+        "DELETE FROM %1 "
+        "WHERE descendant = :id OR ancestor = :id")
+                                               .arg(tree_info.node_path));
+    SqlTrace path_trace(path_query);
+
+    path_query.bindValue(":id", id);
+    if (!path_trace.Exec()) {
+        qWarning() << "Failed to remove node_path 3rd step"
+                   << path_query.lastError().text();
+        Rollback();
+        return false;
+    }
+
+    return Commit();
+}
+
+bool ClosureStore::Move(int id, int new_parent)
+{
+    if (!Begin())
+        return false;
+
+    // Below itself the subtree would lose every path to the rest of the tree, the distance 0
+    // row covers new_parent == id.
+    auto& cycle_query = statements->Prepare(QString("SELECT EXISTS (SELECT 1 FROM %1 WHERE ancestor = :id AND descendant = :new_parent)")
+                                                .arg(tree_info.node_path));
+    SqlTrace cycle_trace(cycle_query);
+
+    cycle_query.bindValue(":id", id);
+    cycle_query.bindValue(":new_parent", new_parent);
+
+    if (!cycle_trace.Exec() || !cycle_trace.Next() || cycle_query.value(0).toBool()) {
+        qWarning() << "Failed to drag node" << id << "below itself or its descendant" << new_parent
+                   << cycle_query.lastError().text();
+        cycle_query.finish();
+        Rollback();
+        return false;
+    }
+
+    cycle_query.finish();
+
+    auto& detach_query = statements->Prepare(QString("DELETE FROM %1 WHERE "
+                                                     "(descendant IN (SELECT descendant FROM %1 WHERE ancestor = :id) AND "
+                                                     "ancestor IN (SELECT ancestor FROM %1 WHERE descendant = :id AND ancestor != descendant))")
+                                                 .arg(tree_info.node_path));
+    SqlTrace detach_trace(detach_query);
+
+    detach_query.bindValue(":id", id);
+    if (!detach_trace.Exec()) {
+        qWarning() << "Failed to drag node_path 1st step"
+                   << detach_query.lastError().text();
+        Rollback();
+        return false;
+    }
+
+    auto& attach_query = statements->Prepare(QString("INSERT INTO %1 (ancestor, descendant, distance) "
+                                                     "SELECT p.ancestor, s.descendant, p.distance + s.distance + 1 "
+                                                     "FROM %1 p "
+                                                     "CROSS JOIN %1 s "
+                                                     "WHERE p.descendant = :new_parent AND s.ancestor = :id")
+                                                 .arg(tree_info.node_path));
+    SqlTrace attach_trace(attach_query);
+
+    attach_query.bindValue(":id", id);
+    attach_query.bindValue(":new_parent", new_parent);
+
+    if (!attach_trace.Exec()) {
+        qWarning() << "Failed to drag node_path 2nd step"
+                   << attach_query.lastError().text();
+        Rollback();
+        return false;
+    }
+
+    return Commit();
+}
+
+int ClosureStore::Copy(int id, int new_parent, int base)
+{
+    if (!Begin())
+        return 0;
+
+    auto Fail = [this](const QSqlQuery& query, const char* step) {
+        qWarning() << "Failed to copy node" << step << query.lastError().text();
+        Rollback();
+        return 0;
+    };
+
+    if (!base)
+        base = NextId();
+
+    if (!base) {
+        Rollback();
+        return 0;
+    }
+
+    auto& create_query = statements->Prepare("CREATE TEMP TABLE IF NOT EXISTS copy_map (old_id INTEGER PRIMARY KEY, new_id INTEGER NOT NULL)");
+    SqlTrace create_trace(create_query);
+
+    if (!create_trace.Exec())
+        return Fail(create_query, "map");
+
+    auto& clear_query = statements->Prepare("DELETE FROM temp.copy_map");
+    SqlTrace clear_trace(clear_query);
+
+    if (!clear_trace.Exec())
+        return Fail(clear_query, "map");
+
+    // The subtree root sorts first and receives base, its descendants follow by depth.
+    auto& map_query = statements->Prepare(QString("INSERT INTO temp.copy_map (old_id, new_id) "
+                                                  "SELECT descendant, :base + ROW_NUMBER() OVER (ORDER BY distance, descendant) - 1 "
+                                                  "FROM %1 WHERE ancestor = :id")
+                                              .arg(tree_info.node_path));
+    SqlTrace map_trace(map_query);
+
+    map_query.bindValue(":base", base);
+    map_query.bindValue(":id", id);
+    if (!map_trace.Exec())
+        return Fail(map_query, "map");
+
+    auto& node_query = statements->Prepare(QString("INSERT INTO %1 (id, name, description) "
+                                                   "SELECT m.new_id, n.name, n.description FROM temp.copy_map m "
+                                                   "INNER JOIN %1 n ON n.id = m.old_id ORDER BY m.new_id")
+                                               .arg(tree_info.node));
+    SqlTrace node_trace(node_query);
+
+    if (!node_trace.Exec())
+        return Fail(node_query, "node");
+
+    // Rows inside the copied subtree are remapped, rows above it come from the new parent.
+    auto& path_query = statements->Prepare(QString("INSERT INTO %1 (ancestor, descendant, distance) "
+                                                   "SELECT a.new_id, d.new_id, p.distance FROM temp.copy_map d "
+                                                   "INNER JOIN %1 p ON p.descendant = d.old_id "
+                                                   "INNER JOIN temp.copy_map a ON a.old_id = p.ancestor "
+                                                   "UNION ALL "
+                                                   "SELECT t.ancestor, d.new_id, t.distance + p.distance + 1 FROM temp.copy_map d "
+                                                   "INNER JOIN %1 p ON p.descendant = d.old_id AND p.ancestor = :id "
+                                                   "INNER JOIN %1 t ON t.descendant = :new_parent")
+                                               .arg(tree_info.node_path));
+    SqlTrace path_trace(path_query);
+
+    path_query.bindValue(":id", id);
+    path_query.bindValue(":new_parent", new_parent);
+    if (!path_trace.Exec())
+        return Fail(path_query, "node_path");
+
+    if (!Commit())
+        return Fail(path_query, "commit");
+
+    return base;
+}
+
+bool ClosureStore::FetchNode(int id, QString& name, QString& description)
+{
+    auto& query = statements->Prepare(QString("SELECT name, description FROM %1 WHERE id = :id").arg(tree_info.node));
+    SqlTrace trace(query);
+
+    query.bindValue(":id", id);
+
+    if (!trace.Exec() || !trace.Next())
+        return false;
+
+    name = query.value(0).toString();
+    description = query.value(1).toString();
+
+    query.finish();
+    return true;
+}
+
+int ClosureStore::NextId()
+{
+    return Schema::NextId(db, tree_info.node);
+}
+
+int ClosureStore::FetchParent(int id)
+{
+    auto& query = statements->Prepare(QString("SELECT ancestor FROM %1 WHERE descendant = :id AND distance = 1").arg(tree_info.node_path));
+    SqlTrace trace(query);
+
+    query.bindValue(":id", id);
+
+    if (!trace.Exec() || !trace.Next())
+        return -1;
+
+    int ancestor = query.value(0).toInt();
+    query.finish();
+
+    return ancestor;
+}
+
+bool ClosureStore::FetchParents(const QList<int>& ids, QHash<int, int>& parents)
+{
+    parents.clear();
+    if (ids.isEmpty())
+        return true;
+
+    auto query = QSqlQuery(db);
+    SqlTrace trace(query);
+    query.setForwardOnly(true);
+
+    // However many ids, one statement: they travel as a JSON array.
+    query.prepare(QString("SELECT descendant, ancestor FROM %1 "
+                          "WHERE distance = 1 AND descendant IN (SELECT value FROM json_each(:ids))")
+                      .arg(tree_info.node_path));
+
+    QStringList values;
+    values.reserve(ids.size());
+    for (int id : ids)
+        values << QString::number(id);
+
+    query.bindValue(":ids", QString("[%1]").arg(values.join(',')));
+
+    if (!trace.Exec()) {
+        qWarning() << "Error query parents" << query.lastError().text();
+        return false;
+    }
+
+    parents.reserve(ids.size());
+    for (int id : ids)
+        parents.insert(id, -1);
+
+    while (trace.Next())
+        parents.insert(query.value(0).toInt(), query.value(1).toInt());
+
+    return true;
+}
+
+QStringList ClosureStore::NumberedNames(const QString& pattern, int count, int first)
+{
+    QStringList names;
+    names.reserve(qMax(count, 0));
+
+    for (int i = 0; i < count; ++i)
+        names << pattern.arg(first + i);
+
+    return names;
+}
+
+bool ClosureStore::Begin()
+{
+    // A savepoint rather than BEGIN, so edits also run inside the writer's batch transaction.
+    return SqlConnection::Exec(db, "SAVEPOINT closure_store");
+}
+
+bool ClosureStore::Commit()
+{
+    return SqlConnection::Exec(db, "RELEASE closure_store");
+}
+
+void ClosureStore::Rollback()
+{
+    SqlConnection::Exec(db, "ROLLBACK TO closure_store");
+    SqlConnection::Exec(db, "RELEASE closure_store");
+}
@@ -0,0 +1,51 @@
+#ifndef CLOSURESTORE_H
+#define CLOSURESTORE_H
+
+#include "tree.h"
+#include <QHash>
+#include <QSqlDatabase>
+#include <QStringList>
+#include <QVariant>
+#include <memory>
+
+class StatementCache;
+
+// Writes and point reads on the node and closure tables of one tree. Every mutation
+// runs in its own savepoint through cached statements, the closure rows of one edit
+// are written together or not at all. The in-memory graph is left to the caller.
+
+class ClosureStore {
+public:
+    ClosureStore(const QSqlDatabase& db, const TreeInfo& tree_info, StatementCache* statements = nullptr);
+    ~ClosureStore();
+
+    int Insert(int parent, const QString& name); // id of the new node, 0 on failure
+    // Children with consecutive ids from first (NextId() when 0) in one savepoint, returns
+    // the first id or 0 on failure.
+    int InsertChildren(int parent, const QStringList& names, int first = 0);
+    bool Update(int id, const QString& column, const QVariant& value);
+    bool Remove(int id);
+    bool Move(int id, int new_parent);
+    int Copy(int id, int new_parent, int base = 0); // id of the copied subtree root, 0 on failure
+
+    int NextId(); // 0 on failure
+    bool FetchNode(int id, QString& name, QString& description);
+    int FetchParent(int id);
+    bool FetchParents(const QList<int>& ids, QHash<int, int>& parents); // by id, -1 at the top level
+
+    static QStringList NumberedNames(const QString& pattern, int count, int first = 1); // "Account %1"
+
+private:
+    bool Begin();
+    bool Commit();
+    void Rollback();
+
+private:
+    QSqlDatabase db;
+    TreeInfo tree_info;
+
+    StatementCache* statements { nullptr };
+    std::unique_ptr<StatementCache> own_statements;
+};
+
+#endif // CLOSURESTORE_H
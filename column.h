@@ -0,0 +1,132 @@
+#ifndef COLUMN_H
+#define COLUMN_H
+
+#include <QLocale>
+#include <QVariant>
+#include <array>
+#include <type_traits>
+
+// One model column: header text, SQL column (nullptr when it is not persisted),
+// accessors, display formatting, ordering, alignment and item flags. Columns are built from member pointers at
+// compile time, models index the table by column number instead of switching on it.
+
+template <typename Row>
+struct Column {
+    const char* header;
+    const char* sql;
+
+    QVariant (*get)(const Row& row);
+    bool (*set)(Row& row, const QVariant& value); // nullptr for read-only columns
+    QVariant (*display)(const Row& row);
+    bool (*less)(const Row& lhs, const Row& rhs);
+
+    Qt::ItemFlags flags;
+    Qt::Alignment alignment;
+};
+
+template <typename Row>
+struct ColumnSet {
+    const Column<Row>* columns { nullptr };
+    int size { 0 };
+
+    template <std::size_t N>
+    constexpr ColumnSet(const std::array<Column<Row>, N>& array)
+        : columns { array.data() }
+        , size { int(N) }
+    {
+    }
+
+    const Column<Row>& operator[](int column) const { return columns[column]; }
+    bool Contains(int column) const { return column >= 0 && column < size; }
+};
+
+namespace column {
+template <auto Member>
+struct Traits;
+
+template <typename R, typename T, T R::*Member>
+struct Traits<Member> {
+    using Row = R;
+    using Type = T;
+};
+
+template <auto Member>
+QVariant Get(const typename Traits<Member>::Row& row)
+{
+    return QVariant::fromValue(row.*Member);
+}
+
+template <auto Member>
+bool Set(typename Traits<Member>::Row& row, const QVariant& value)
+{
+    using Type = typename Traits<Member>::Type;
+
+    // Amounts are typed in the user's locale, "1,234.50" included, or in the C locale.
+    if constexpr (std::is_floating_point_v<Type>) {
+        if (value.typeId() == QMetaType::QString) {
+            bool ok = false;
+            Type number = QLocale().toDouble(value.toString(), &ok);
+            if (!ok)
+                number = QLocale::c().toDouble(value.toString(), &ok);
+
+            if (!ok)
+                return false;
+
+            row.*Member = number;
+            return true;
+        }
+    }
+
+    // canConvert() only looks at the types, convert() reports whether this value converted.
+    QVariant converted = value;
+    if (!converted.convert(QMetaType::fromType<Type>()))
+        return false;
+
+    row.*Member = converted.value<Type>();
+    return true;
+}
+
+// Amounts are shown with two decimals in the user's locale, everything else as stored.
+template <auto Member>
+QVariant Display(const typename Traits<Member>::Row& row)
+{
+    using Type = typename Traits<Member>::Type;
+
+    if constexpr (std::is_floating_point_v<Type>)
+        return QLocale().toString(row.*Member, 'f', 2);
+    else
+        return QVariant::fromValue(row.*Member);
+}
+
+template <auto Member>
+constexpr Qt::Alignment Alignment()
+{
+    using Type = typename Traits<Member>::Type;
+
+    return (std::is_arithmetic_v<Type> ? Qt::AlignRight : Qt::AlignLeft) | Qt::AlignVCenter;
+}
+
+template <auto Member>
+bool Less(const typename Traits<Member>::Row& lhs, const typename Traits<Member>::Row& rhs)
+{
+    return lhs.*Member < rhs.*Member;
+}
+}
+
+template <auto Member>
+constexpr Column<typename column::Traits<Member>::Row> MakeColumn(
+    const char* header, const char* sql, bool editable, Qt::ItemFlags flags = {})
+{
+    return {
+        header,
+        sql,
+        &column::Get<Member>,
+        editable ? &column::Set<Member> : nullptr,
+        &column::Display<Member>,
+        &column::Less<Member>,
+        editable ? flags | Qt::ItemIsEditable : flags,
+        column::Alignment<Member>(),
+    };
+}
+
+#endif // COLUMN_H
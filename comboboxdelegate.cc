@@ -2,7 +2,7 @@
 #include <QComboBox>
 #include <QCompleter>
 
-ComboBoxDelegate::ComboBoxDelegate(const QMap<QString, int>& leaf_paths, QObject* parent)
+ComboBoxDelegate::ComboBoxDelegate(const LeafPathSet& leaf_paths, QObject* parent)
     : QStyledItemDelegate { parent }
     , leaf_paths { leaf_paths }
 {
@@ -14,8 +14,9 @@ QWidget* ComboBoxDelegate::createEditor(QWidget* parent, const QStyleOptionViewI
     Q_UNUSED(index);
 
     auto* editor = new QComboBox(parent);
+    const auto paths = leaf_paths.Render();
 
-    for (auto it = leaf_paths.begin(); it != leaf_paths.end(); ++it) {
+    for (auto it = paths.begin(); it != paths.end(); ++it) {
         editor->addItem(it.key(), it.value());
     }
 
@@ -36,8 +37,9 @@ void ComboBoxDelegate::setEditorData(QWidget* editor, const QModelIndex& index)
 {
     auto editor_new = qobject_cast<QComboBox*>(editor);
     Q_ASSERT(editor_new);
+    const auto paths = leaf_paths.Render();
 
-    for (auto it = leaf_paths.begin(); it != leaf_paths.end(); ++it) {
+    for (auto it = paths.begin(); it != paths.end(); ++it) {
         editor_new->addItem(it.key(), it.value());
     }
 }
@@ -55,7 +57,14 @@ void ComboBoxDelegate::setModelData(QWidget* editor, QAbstractItemModel* model,
     model->setData(index, editor_new->currentText());
 }
 
-void ComboBoxDelegate::ReceiveLeafPaths(const QMap<QString, int>& paths)
+void ComboBoxDelegate::ReceiveLeafPaths(const LeafPathSet& paths)
 {
     leaf_paths = paths;
 }
+
+void ComboBoxDelegate::PatchLeafPaths(const LeafPathSet& paths, const QList<int>& ids)
+{
+    // Editors render the set when they open, there is nothing cached to patch.
+    Q_UNUSED(ids);
+    leaf_paths = paths;
+}
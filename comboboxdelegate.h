@@ -1,12 +1,13 @@
 #ifndef COMBOBOXDELEGATE_H
 #define COMBOBOXDELEGATE_H
 
+#include "leafpathset.h"
 #include <QStyledItemDelegate>
 
 class ComboBoxDelegate : public QStyledItemDelegate {
     Q_OBJECT
 public:
-    explicit ComboBoxDelegate(const QMap<QString, int>& leaf_paths, QObject* parent = nullptr);
+    explicit ComboBoxDelegate(const LeafPathSet& leaf_paths, QObject* parent = nullptr);
 
     QWidget* createEditor(QWidget* parent, const QStyleOptionViewItem& option, const QModelIndex& index) const override;
     void setEditorData(QWidget* editor, const QModelIndex& index) const override;
@@ -14,10 +15,11 @@ public:
     void setModelData(QWidget* editor, QAbstractItemModel* model, const QModelIndex& index) const override;
 
 public slots:
-    void ReceiveLeafPaths(const QMap<QString, int>& paths);
+    void ReceiveLeafPaths(const LeafPathSet& paths);
+    void PatchLeafPaths(const LeafPathSet& paths, const QList<int>& ids);
 
 private:
-    QMap<QString, int> leaf_paths;
+    LeafPathSet leaf_paths;
 };
 
 #endif // COMBOBOXDELEGATE_H
@@ -0,0 +1,77 @@
+#include "connectionmanager.h"
+#include "sqlwriter.h"
+#include <QAtomicInt>
+#include <QThread>
+#include <QThreadPool>
+
+struct ConnectionManager::ReaderConnection {
+    QString name;
+
+    ~ReaderConnection()
+    {
+        QSqlDatabase::database(name, false).close();
+        QSqlDatabase::removeDatabase(name);
+    }
+};
+
+ConnectionManager::ConnectionManager(const QSqlDatabase& db, const SqlProfile& profile)
+    : connection { db.connectionName() }
+    , profile { profile }
+    , owner { QThread::currentThread() }
+{
+    auto database = db.databaseName();
+    concurrent = !database.isEmpty() && database != ":memory:";
+
+    if (concurrent)
+        writer = std::make_unique<SqlWriter>(connection, profile);
+    else
+        writer = std::make_unique<SqlWriter>(db);
+}
+
+ConnectionManager::~ConnectionManager()
+{
+    // Commits whatever is still queued before the connections go away.
+    writer.reset();
+
+    // Pool threads keep their readers until they expire, the thread storage does not delete
+    // them once it is gone. No task may hold one of them while it is removed.
+    QThreadPool::globalInstance()->waitForDone();
+
+    QMutexLocker locker(&mutex);
+
+    // database() refuses connections of other threads, dropping the last reference closes them.
+    for (const QString& name : qAsConst(reader_names))
+        QSqlDatabase::removeDatabase(name);
+}
+
+QSqlDatabase ConnectionManager::Reader()
+{
+    if (QThread::currentThread() == owner || !concurrent)
+        return QSqlDatabase::database(connection, false);
+
+    if (!readers.hasLocalData()) {
+        static QAtomicInt serial;
+        auto name = QString("%1_reader_%2").arg(connection).arg(serial.fetchAndAddRelaxed(1));
+
+        auto db = SqlConnection::Clone(connection, name, profile);
+        if (db.isOpen())
+            SqlConnection::Exec(db, "PRAGMA query_only = ON");
+
+        readers.setLocalData(new ReaderConnection { name });
+
+        QMutexLocker locker(&mutex);
+        reader_names << name;
+    }
+
+    return QSqlDatabase::database(readers.localData()->name, false);
+}
+
+SqlWriter* ConnectionManager::Writer() const
+{
+    return writer.get();
+}
+
+bool ConnectionManager::IsConcurrent() const
+{
+    return concurrent;
+}
@@ -0,0 +1,45 @@
+#ifndef CONNECTIONMANAGER_H
+#define CONNECTIONMANAGER_H
+
+#include "sqlconnection.h"
+#include <QMutex>
+#include <QSqlDatabase>
+#include <QStringList>
+#include <QThreadStorage>
+#include <memory>
+
+class QThread;
+class SqlWriter;
+
+// Connections of one database file. The thread that creates the manager keeps reading
+// through the connection it was given, every other thread gets its own query_only
+// connection on first use, closed again when the thread exits or, for pool threads that
+// outlive the manager, when the manager goes. WAL lets those readers run
+// next to the writer without blocking either side. All model writes go through Writer().
+// An in-memory database has a single connection, then everything runs on it inline.
+
+class ConnectionManager {
+public:
+    explicit ConnectionManager(const QSqlDatabase& db, const SqlProfile& profile = SqlProfile());
+    ~ConnectionManager();
+
+    QSqlDatabase Reader();
+    SqlWriter* Writer() const;
+    bool IsConcurrent() const;
+
+private:
+    struct ReaderConnection;
+
+private:
+    QString connection;
+    SqlProfile profile;
+    QThread* owner { nullptr };
+    bool concurrent { false };
+
+    QThreadStorage<ReaderConnection*> readers;
+    QMutex mutex;
+    QStringList reader_names; // every reader connection ever opened
+    std::unique_ptr<SqlWriter> writer;
+};
+
+#endif // CONNECTIONMANAGER_H
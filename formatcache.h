@@ -0,0 +1,60 @@
+#ifndef FORMATCACHE_H
+#define FORMATCACHE_H
+
+#include <QCache>
+#include <QVariant>
+#include <QVector>
+#include <iterator>
+
+// Roles served from FormatCache, a row entry holds one value per column and role in this order.
+inline constexpr int kFormatRoles[] { Qt::DisplayRole, Qt::TextAlignmentRole, Qt::ToolTipRole };
+inline constexpr int kFormatRoleCount = int(std::size(kFormatRoles));
+
+inline int FormatSlot(int role)
+{
+    for (int slot = 0; slot != kFormatRoleCount; ++slot) {
+        if (kFormatRoles[slot] == role)
+            return slot;
+    }
+
+    return -1;
+}
+
+// Formatted values of the most recently painted rows, keyed by the row object. A miss
+// formats the whole row once, so repaints and the other roles of that row cost a lookup.
+// Models drop entries on dataChanged and clear on layout, reset, remove and move.
+
+template <typename Row>
+class FormatCache {
+public:
+    explicit FormatCache(int capacity = 4096)
+    {
+        cache.setMaxCost(capacity);
+    }
+
+    // format(const Row&) returns columns * kFormatRoleCount values.
+    template <typename Format>
+    QVariant Value(const Row* row, int column, int role, Format format) const
+    {
+        int slot = FormatSlot(role);
+        if (slot < 0)
+            return QVariant();
+
+        auto* values = cache.object(row);
+
+        if (!values) {
+            values = new QVector<QVariant>(format(*row));
+            cache.insert(row, values);
+        }
+
+        return values->value(column * kFormatRoleCount + slot);
+    }
+
+    void Remove(const Row* row) { cache.remove(row); }
+    void Clear() { cache.clear(); }
+
+private:
+    mutable QCache<const Row*, QVector<QVariant>> cache;
+};
+
+#endif // FORMATCACHE_H
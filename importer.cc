@@ -0,0 +1,398 @@
+#include "importer.h"
+#include "profiler.h"
+#include "schema.h"
+#include <QDate>
+#include <QDebug>
+#include <QFile>
+#include <QSet>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QTextStream>
+
+namespace {
+const int kBatchSize = 50000;
+}
+
+Importer::Importer(const QSqlDatabase& db, const TreeInfo& tree_info, QChar separator)
+    : db { db }
+    , tree_info { tree_info }
+    , separator { separator }
+{
+}
+
+bool Importer::ImportAccounts(const QString& file_name)
+{
+    QFile file(file_name);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        qWarning() << "Failed to open" << file_name << file.errorString();
+        return false;
+    }
+
+    if (!Begin())
+        return End(false);
+
+    QTextStream stream(&file);
+    QString line;
+    int line_number = 0;
+    bool result = true;
+
+    while (result && stream.readLineInto(&line)) {
+        ++line_number;
+        if (line.isEmpty())
+            continue;
+
+        auto fields = SplitCsv(line);
+        if (line_number == 1 && fields.value(0).compare("path", Qt::CaseInsensitive) == 0)
+            continue;
+
+        auto path = fields.value(0).trimmed();
+
+        if (!path.isEmpty() && !Resolve(path, fields.value(1))) {
+            qWarning() << "Failed to import account" << path << "at line" << line_number << "of" << file_name;
+            result = false;
+        }
+
+        if (result && path_ancestor.size() >= kBatchSize)
+            result = FlushNodes();
+    }
+
+    return End(result && FlushNodes() && Schema::Touch(db, tree_info.node));
+}
+
+bool Importer::ImportTransactions(const QString& file_name)
+{
+    if (tree_info.transaction.isEmpty())
+        return false;
+
+    QFile file(file_name);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        qWarning() << "Failed to open" << file_name << file.errorString();
+        return false;
+    }
+
+    if (!Begin())
+        return End(false);
+
+    QTextStream stream(&file);
+    QString line;
+    int line_number = 0;
+    int skipped = 0;
+    int malformed = 0;
+    bool result = true;
+
+    while (result && stream.readLineInto(&line)) {
+        ++line_number;
+        if (line.isEmpty())
+            continue;
+
+        auto fields = SplitCsv(line);
+        if (line_number == 1 && fields.value(0).compare("source", Qt::CaseInsensitive) == 0)
+            continue;
+
+        // The date triggers are dropped for the load, dates are checked here instead.
+        auto date_field = fields.value(6).trimmed();
+        auto date = QDate::fromString(date_field, Qt::ISODate);
+
+        if (!date_field.isEmpty() && !date.isValid()) {
+            ++malformed;
+            continue;
+        }
+
+        int source = paths.value(fields.value(0).trimmed());
+        int target = paths.value(fields.value(1).trimmed());
+
+        if (!source || !target) {
+            ++skipped;
+            continue;
+        }
+
+        transaction_source << source;
+        transaction_target << target;
+        transaction_note << fields.value(2);
+        transaction_description << fields.value(3);
+        transaction_debit << (fields.value(4).isEmpty() ? QVariant() : QVariant(fields.value(4).toDouble()));
+        transaction_credit << (fields.value(5).isEmpty() ? QVariant() : QVariant(fields.value(5).toDouble()));
+        transaction_date << (date.isValid() ? QVariant(date.toString(Qt::ISODate)) : QVariant());
+
+        if (transaction_source.size() >= kBatchSize)
+            result = FlushTransactions();
+    }
+
+    if (skipped)
+        qWarning() << "Skipped" << skipped << "transactions with unknown accounts in" << file_name;
+
+    if (malformed)
+        qWarning() << "Skipped" << malformed << "transactions with dates other than YYYY-MM-DD in" << file_name;
+
+    return End(result && FlushTransactions() && Schema::RebuildBalances(db, tree_info)
+        && Schema::Touch(db, tree_info.transaction) && Schema::TouchAccounts(db, tree_info.transaction));
+}
+
+QStringList Importer::SplitCsv(const QString& line)
+{
+    QStringList fields;
+    QString field;
+    bool quoted = false;
+
+    for (int i = 0; i < line.size(); ++i) {
+        QChar c = line.at(i);
+
+        if (quoted) {
+            if (c != '"') {
+                field += c;
+            } else if (i + 1 < line.size() && line.at(i + 1) == '"') {
+                field += c;
+                ++i;
+            } else {
+                quoted = false;
+            }
+        } else if (c == '"') {
+            quoted = true;
+        } else if (c == ',') {
+            fields << field;
+            field.clear();
+        } else {
+            field += c;
+        }
+    }
+
+    fields << field;
+    return fields;
+}
+
+bool Importer::Begin()
+{
+    if (!db.transaction()) {
+        qWarning() << "Failed to begin import" << db.lastError().text();
+        return false;
+    }
+
+    return Schema::DropIndexes(db, tree_info) && Schema::DropTriggers(db, tree_info) && LoadPaths();
+}
+
+bool Importer::End(bool result)
+{
+    if (result)
+        result = Schema::CreateIndexes(db, tree_info) && Schema::CreateTriggers(db, tree_info) && db.commit();
+
+    if (!result) {
+        qWarning() << "Import failed, rolling back" << db.lastError().text();
+        db.rollback();
+
+        loaded = false;
+        paths.clear();
+        parents.clear();
+
+        node_id.clear();
+        node_name.clear();
+        node_description.clear();
+        path_ancestor.clear();
+        path_descendant.clear();
+        path_distance.clear();
+        transaction_source.clear();
+        transaction_target.clear();
+        transaction_note.clear();
+        transaction_description.clear();
+        transaction_debit.clear();
+        transaction_credit.clear();
+        transaction_date.clear();
+    }
+
+    return result;
+}
+
+bool Importer::LoadPaths()
+{
+    if (loaded)
+        return true;
+
+    auto query = QSqlQuery(db);
+    SqlTrace trace(query);
+    query.setForwardOnly(true);
+
+    query.prepare(QString("SELECT id, name FROM %1").arg(tree_info.node));
+    if (!trace.Exec()) {
+        qWarning() << "Error query data from node" << query.lastError().text();
+        return false;
+    }
+
+    QHash<int, QString> names;
+    int id = 0;
+
+    while (trace.Next()) {
+        id = query.value(0).toInt();
+        names.insert(id, query.value(1).toString());
+    }
+
+    // Past the ids of deleted nodes as well, their transactions must not attach to new accounts.
+    id_next = Schema::NextId(db, tree_info.node);
+    if (!id_next)
+        return false;
+
+    query.prepare(QString("SELECT ancestor, descendant FROM %1 WHERE distance = 1").arg(tree_info.node_path));
+    if (!trace.Exec()) {
+        qWarning() << "Error query data from node path" << query.lastError().text();
+        return false;
+    }
+
+    while (trace.Next())
+        parents.insert(query.value(1).toInt(), query.value(0).toInt());
+
+    QHash<int, QString> full_paths;
+    full_paths.reserve(names.size());
+    paths.reserve(names.size());
+
+    // Chains are walked up iteratively until a node with a known path, so a deep tree cannot
+    // exhaust the stack, and a chain that returns to itself is reported instead of followed.
+    for (auto it = names.cbegin(); it != names.cend(); ++it) {
+        QList<int> chain;
+        QSet<int> visited;
+
+        for (int id = it.key(); id && !full_paths.contains(id); id = parents.value(id)) {
+            if (visited.contains(id)) {
+                qWarning() << "Import failed, the parents of" << tree_info.node << id << "form a cycle";
+                return false;
+            }
+
+            visited.insert(id);
+            chain << id;
+        }
+
+        for (int i = chain.size() - 1; i >= 0; --i) {
+            int id = chain.at(i);
+            int parent = parents.value(id);
+            QString path = parent ? full_paths.value(parent) + separator + names.value(id) : names.value(id);
+
+            full_paths.insert(id, path);
+            if (names.contains(id))
+                paths.insert(path, id);
+        }
+    }
+
+    loaded = true;
+    return true;
+}
+
+int Importer::Resolve(const QString& path, const QString& description)
+{
+    if (path.isEmpty())
+        return 0;
+
+    int id = paths.value(path);
+    if (id)
+        return id;
+
+    int parent = 0;
+    int from = 0;
+
+    while (true) {
+        int to = path.indexOf(separator, from);
+        QString prefix = to == -1 ? path : path.left(to);
+
+        id = paths.value(prefix);
+
+        if (!id) {
+            id = id_next++;
+
+            node_id << id;
+            node_name << prefix.mid(from);
+            node_description << (to == -1 && !description.isEmpty() ? QVariant(description) : QVariant());
+
+            paths.insert(prefix, id);
+            if (parent)
+                parents.insert(id, parent);
+
+            // LoadPaths rejected cyclic parents, a chain longer than the tree still means one.
+            int distance = 0;
+            for (int ancestor = id; ancestor; ancestor = parents.value(ancestor), ++distance) {
+                if (distance > parents.size()) {
+                    qWarning() << "Import failed, the parents above" << prefix << "form a cycle";
+                    return 0;
+                }
+
+                path_ancestor << ancestor;
+                path_descendant << id;
+                path_distance << distance;
+            }
+        }
+
+        if (to == -1)
+            return id;
+
+        parent = id;
+        from = to + 1;
+    }
+}
+
+bool Importer::FlushNodes()
+{
+    if (node_id.isEmpty())
+        return true;
+
+    auto query = QSqlQuery(db);
+    SqlTrace trace(query);
+
+    query.prepare(QString("INSERT INTO %1 (id, name, description) VALUES (?, ?, ?)").arg(tree_info.node));
+    query.addBindValue(node_id);
+    query.addBindValue(node_name);
+    query.addBindValue(node_description);
+
+    if (!trace.ExecBatch()) {
+        qWarning() << "Failed to import node" << query.lastError().text();
+        return false;
+    }
+
+    query.prepare(QString("INSERT INTO %1 (ancestor, descendant, distance) VALUES (?, ?, ?)").arg(tree_info.node_path));
+    query.addBindValue(path_ancestor);
+    query.addBindValue(path_descendant);
+    query.addBindValue(path_distance);
+
+    if (!trace.ExecBatch()) {
+        qWarning() << "Failed to import node_path" << query.lastError().text();
+        return false;
+    }
+
+    node_id.clear();
+    node_name.clear();
+    node_description.clear();
+    path_ancestor.clear();
+    path_descendant.clear();
+    path_distance.clear();
+
+    return true;
+}
+
+bool Importer::FlushTransactions()
+{
+    if (transaction_source.isEmpty())
+        return true;
+
+    auto query = QSqlQuery(db);
+    SqlTrace trace(query);
+
+    query.prepare(QString("INSERT INTO %1 (source, target, note, description, debit, credit, date) "
+                          "VALUES (?, ?, ?, ?, ?, ?, COALESCE(?, '1970-01-01'))")
+                      .arg(tree_info.transaction));
+    query.addBindValue(transaction_source);
+    query.addBindValue(transaction_target);
+    query.addBindValue(transaction_note);
+    query.addBindValue(transaction_description);
+    query.addBindValue(transaction_debit);
+    query.addBindValue(transaction_credit);
+    query.addBindValue(transaction_date);
+
+    if (!trace.ExecBatch()) {
+        qWarning() << "Failed to import transaction" << query.lastError().text();
+        return false;
+    }
+
+    transaction_source.clear();
+    transaction_target.clear();
+    transaction_note.clear();
+    transaction_description.clear();
+    transaction_debit.clear();
+    transaction_credit.clear();
+    transaction_date.clear();
+
+    return true;
+}
@@ -0,0 +1,63 @@
+#ifndef IMPORTER_H
+#define IMPORTER_H
+
+#include "tree.h"
+#include <QHash>
+#include <QSqlDatabase>
+#include <QVariantList>
+
+// Bulk loads CSV files into one tree inside a single transaction.
+// Accounts: path,description        e.g. Assets/Bank/Cash,"Petty cash"
+// Transactions: source,target,note,description,debit,credit[,date]   (source and target are paths,
+//               date is YYYY-MM-DD, undated rows are opening balances)
+// Missing accounts along a path are created, closure rows are generated in memory
+// and every table is filled through prepared batched inserts with the secondary
+// indexes and the change triggers dropped until the load is done.
+
+class Importer {
+public:
+    Importer(const QSqlDatabase& db, const TreeInfo& tree_info, QChar separator = '/');
+
+    bool ImportAccounts(const QString& file_name);
+    bool ImportTransactions(const QString& file_name);
+
+    static QStringList SplitCsv(const QString& line);
+
+private:
+    bool Begin();
+    bool End(bool result);
+
+    bool LoadPaths();
+    int Resolve(const QString& path, const QString& description);
+
+    bool FlushNodes();
+    bool FlushTransactions();
+
+private:
+    QSqlDatabase db;
+    TreeInfo tree_info;
+    QChar separator;
+
+    QHash<QString, int> paths;
+    QHash<int, int> parents;
+    int id_next { 1 };
+    bool loaded { false };
+
+    QVariantList node_id;
+    QVariantList node_name;
+    QVariantList node_description;
+
+    QVariantList path_ancestor;
+    QVariantList path_descendant;
+    QVariantList path_distance;
+
+    QVariantList transaction_source;
+    QVariantList transaction_target;
+    QVariantList transaction_note;
+    QVariantList transaction_description;
+    QVariantList transaction_debit;
+    QVariantList transaction_credit;
+    QVariantList transaction_date;
+};
+
+#endif // IMPORTER_H
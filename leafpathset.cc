@@ -0,0 +1,126 @@
+#include "leafpathset.h"
+#include "stringinterner.h"
+#include "tree.h"
+#include <algorithm>
+
+LeafPathSet::LeafPathSet(StringInterner* pool, QChar separator)
+    : own_pool { pool ? nullptr : std::make_shared<StringInterner>() }
+    , pool { pool ? pool : own_pool.get() }
+    , separator { separator }
+{
+}
+
+void LeafPathSet::Insert(const Node* leaf, const Node* root)
+{
+    QVector<int> path;
+    for (const Node* node = leaf; node && node != root; node = node->parent)
+        path.append(pool->Id(node->name));
+
+    std::reverse(path.begin(), path.end());
+    Insert(leaf->id, path);
+}
+
+void LeafPathSet::Insert(int id, const QStringList& names)
+{
+    QVector<int> path;
+    path.reserve(names.size());
+
+    for (const QString& name : names)
+        path.append(pool->Id(name));
+
+    Insert(id, path);
+}
+
+void LeafPathSet::Insert(int id, const QVector<int>& path)
+{
+    Remove(id);
+    segments.insert(id, path);
+    leaves.insert(path, id);
+}
+
+void LeafPathSet::Remove(int id)
+{
+    auto it = segments.find(id);
+    if (it == segments.end())
+        return;
+
+    if (leaves.value(*it) == id)
+        leaves.remove(*it);
+
+    segments.erase(it);
+}
+
+void LeafPathSet::Clear()
+{
+    segments.clear();
+    leaves.clear();
+}
+
+void LeafPathSet::Merge(const LeafPathSet& other)
+{
+    if (segments.isEmpty()) {
+        segments = other.segments;
+        leaves = other.leaves;
+        return;
+    }
+
+    for (auto it = other.segments.cbegin(); it != other.segments.cend(); ++it)
+        Insert(it.key(), it.value());
+}
+
+int LeafPathSet::Size() const
+{
+    return segments.size();
+}
+
+bool LeafPathSet::Contains(int id) const
+{
+    return segments.contains(id);
+}
+
+QList<int> LeafPathSet::Ids() const
+{
+    return segments.keys();
+}
+
+StringInterner* LeafPathSet::Pool() const
+{
+    return pool;
+}
+
+QString LeafPathSet::Path(int id) const
+{
+    auto it = segments.constFind(id);
+    if (it == segments.constEnd())
+        return QString();
+
+    return pool->Join(*it, separator);
+}
+
+int LeafPathSet::Find(const QString& path) const
+{
+    const auto parts = path.split(separator);
+
+    QVector<int> key;
+    key.reserve(parts.size());
+
+    for (const auto& part : parts) {
+        int id = pool->Find(part);
+        if (id < 0)
+            return 0;
+
+        key.append(id);
+    }
+
+    return leaves.value(key);
+}
+
+QMap<QString, int> LeafPathSet::Render() const
+{
+    QMap<QString, int> paths;
+
+    for (auto it = segments.cbegin(); it != segments.cend(); ++it)
+        paths.insert(pool->Join(it.value(), separator), it.key());
+
+    return paths;
+}
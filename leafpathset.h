@@ -0,0 +1,49 @@
+#ifndef LEAFPATHSET_H
+#define LEAFPATHSET_H
+
+#include <QHash>
+#include <QMap>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <memory>
+
+struct Node;
+class StringInterner;
+
+// Leaf accounts of one tree with their full paths. A path is kept as the pool ids of
+// its segments and only turned into text when asked for, so "Expenses" is stored once
+// however many leaves sit below it, and looking up a typed path compares integers.
+// Copies are cheap, the containers are implicitly shared. A set built without a pool owns
+// one, shared with its copies and gone with the last of them.
+
+class LeafPathSet {
+public:
+    explicit LeafPathSet(StringInterner* pool = nullptr, QChar separator = '/');
+
+    void Insert(const Node* leaf, const Node* root);
+    void Insert(int id, const QStringList& names); // segments from the top, for leaves not in memory
+    void Insert(int id, const QVector<int>& path); // pool ids of the segments
+    void Remove(int id);
+    void Clear();
+    void Merge(const LeafPathSet& other); // same pool, other wins on conflicts
+
+    int Size() const;
+    bool Contains(int id) const;
+    QList<int> Ids() const;
+    StringInterner* Pool() const;
+
+    QString Path(int id) const;
+    int Find(const QString& path) const; // leaf id, 0 when no leaf has that path
+    QMap<QString, int> Render() const; // sorted by path, for editors and completers
+
+private:
+    std::shared_ptr<StringInterner> own_pool;
+    StringInterner* pool { nullptr };
+    QChar separator { '/' };
+
+    QHash<int, QVector<int>> segments;
+    QHash<QVector<int>, int> leaves;
+};
+
+#endif // LEAFPATHSET_H
@@ -1,12 +1,18 @@
 
 #include "mainwindow.h"
+#include "profiler.h"
 
 #include <QApplication>
 
 int main(int argc, char* argv[])
 {
     QApplication a(argc, argv);
+    Profiler::Enable(qEnvironmentVariable("TREEMODEL_TRACE"));
+
     MainWindow w;
     w.show();
-    return a.exec();
+    int result = a.exec();
+
+    Profiler::Write();
+    return result;
 }
@@ -1,10 +1,26 @@
 ﻿#include "mainwindow.h"
 #include "QtSql/qsqlerror.h"
+#include "closurechecker.h"
 #include "comboboxdelegate.h"
+#include "importer.h"
+#include "profiler.h"
+#include "schema.h"
+#include "sqlconnection.h"
+#include "sqlwriter.h"
 #include "ui_mainwindow.h"
+#include "viewportprefetcher.h"
+#include <QClipboard>
 #include <QCompleter>
+#include <QFile>
+#include <QFileDialog>
+#include <QGuiApplication>
 #include <QInputDialog>
+#include <QLocale>
+#include <QMessageBox>
+#include <QSaveFile>
 #include <QTableView>
+#include <QTreeView>
+#include <QtConcurrent>
 
 MainWindow::MainWindow(QWidget* parent)
     : QMainWindow(parent)
@@ -23,38 +39,95 @@ MainWindow::MainWindow(QWidget* parent)
         return;
     }
 
+    SqlConnection::ApplyProfile(db);
+
     ui->setupUi(this);
 
-    auto financial_tree_info = TreeInfo("financial", "financial_path");
-    financial_tree_model = new TreeModel(db, financial_tree_info, ui->treeView);
+    auto tree_infos = QList<TreeInfo> {
+        TreeInfo("financial", "financial_path", "financial_transaction"),
+        TreeInfo("cost_centre", "cost_centre_path"),
+        TreeInfo("project", "project_path"),
+    };
+
+    for (auto& tree_info : tree_infos)
+        Schema::Migrate(db, tree_info);
 
-    ui->treeView->setModel(financial_tree_model);
     ui->treeView->setSelectionMode(QAbstractItemView::SingleSelection);
     ui->treeView->setDragEnabled(true);
     ui->treeView->setAcceptDrops(true);
     ui->treeView->setDropIndicatorShown(true);
+    ui->treeView->setDefaultDropAction(Qt::MoveAction);
     ui->treeView->setSortingEnabled(true);
     //    ui->treeView->setColumnHidden(1, true);
     ui->treeView->setColumnWidth(0, 200);
     ui->treeView->setExpandsOnDoubleClick(true);
+    ui->treeView->setEditTriggers(QAbstractItemView::EditKeyPressed | QAbstractItemView::SelectedClicked);
     ui->treeView->header()->setStretchLastSection(true);
 
     ui->tabWidget->setMovable(true);
     ui->tabWidget->setTabsClosable(true);
     ui->tabWidget->setElideMode(Qt::ElideNone);
+    connect(ui->tabWidget, &QTabWidget::tabCloseRequested, this, &MainWindow::CloseTab);
     ui->gridLayout_2->setContentsMargins(0, 0, 0, 0);
 
-    connect(ui->treeView->selectionModel(), &QItemSelectionModel::currentChanged, this, &MainWindow::CurrentChanged);
+    auto* menu_file = ui->menubar->addMenu("File");
+    connect(menu_file->addAction("Import Accounts..."), &QAction::triggered, this, &MainWindow::ImportAccounts);
+    connect(menu_file->addAction("Import Transactions..."), &QAction::triggered, this, &MainWindow::ImportTransactions);
+    connect(menu_file->addAction("Export Branch..."), &QAction::triggered, this, &MainWindow::ExportBranch);
+    connect(menu_file->addAction("Import Branch..."), &QAction::triggered, this, &MainWindow::ImportBranch);
+    menu_file->addSeparator();
+    connect(menu_file->addAction("Check Tree..."), &QAction::triggered, this, &MainWindow::CheckTree);
+    connect(menu_file->addAction("Export Trial Balance..."), &QAction::triggered, this, &MainWindow::ExportTrialBalance);
+
+    auto* menu_view = ui->menubar->addMenu("View");
+    connect(menu_view->addAction("Summary Levels..."), &QAction::triggered, this, &MainWindow::SummaryLevels);
+
+    connection_manager = new ConnectionManager(db);
+    tree_registry = new TreeRegistry(db, connection_manager, this);
+    connect(tree_registry, &TreeRegistry::TreeLoaded, this, &MainWindow::TreeLoaded);
+    tree_registry->Load(tree_infos);
 }
 
 MainWindow::~MainWindow()
 {
     delete ui;
+    delete report_engine;
+    delete table_cache;
+    delete tree_registry;
+    delete connection_manager;
     db.close();
 }
 
+void MainWindow::TreeLoaded(TreeModel* model)
+{
+    Profiler::Watch(model);
+
+    if (model->GetTreeInfo().node == "financial") {
+        financial_tree_model = model;
+        table_cache = new TableCache(db, financial_tree_model, connection_manager, this);
+
+        ui->treeView->setModel(financial_tree_model);
+        new ViewportPrefetcher(ui->treeView);
+        connect(ui->treeView->selectionModel(), &QItemSelectionModel::currentChanged, this, &MainWindow::CurrentChanged);
+        return;
+    }
+
+    auto* tree_view = new QTreeView();
+    tree_view->setModel(model);
+    tree_view->setSelectionMode(QAbstractItemView::SingleSelection);
+    tree_view->setSortingEnabled(true);
+    tree_view->setColumnWidth(0, 200);
+    tree_view->header()->setStretchLastSection(true);
+    new ViewportPrefetcher(tree_view);
+
+    ui->tabWidget->addTab(tree_view, model->GetTreeInfo().node);
+}
+
 void MainWindow::on_btnDelete_clicked()
 {
+    if (!financial_tree_model)
+        return;
+
     auto index = ui->treeView->selectionModel()->selectedRows();
     for (auto index : index) {
         if (!index.isValid())
@@ -66,6 +139,9 @@ void MainWindow::on_btnDelete_clicked()
 
 void MainWindow::on_btnInsert_clicked()
 {
+    if (!financial_tree_model)
+        return;
+
     auto indexes = ui->treeView->selectionModel()->selectedRows();
     for (auto index : indexes) {
         if (!index.isValid())
@@ -78,7 +154,36 @@ void MainWindow::on_btnInsert_clicked()
 
 void MainWindow::CurrentChanged(const QModelIndex& index)
 {
-    //    qDebug() << index.data().toString() << "current changed";
+    if (!index.isValid() || !financial_tree_model)
+        return;
+
+    // Only stored nodes carry a total.
+    auto* node = static_cast<Node*>(index.internalPointer());
+    if (node->id <= 0)
+        return;
+
+    auto ShowTotal = [this, id = node->id, name = node->name](double total) {
+        // The selection moved on while the total was summed.
+        auto current = ui->treeView->currentIndex();
+        if (!current.isValid() || static_cast<Node*>(current.internalPointer())->id != id)
+            return;
+
+        ui->statusbar->showMessage(QString("%1: %2").arg(name, QLocale().toString(total, 'f', 2)));
+    };
+
+    auto tree_info = financial_tree_model->GetTreeInfo();
+
+    // An in-memory database has no second connection to sum on.
+    if (!connection_manager->IsConcurrent()) {
+        ShowTotal(AggregateEngine(db, tree_info).Total(node->id));
+        return;
+    }
+
+    // A top level node sums the whole ledger, that scan runs on a reader connection.
+    QtConcurrent::run([connections = connection_manager, tree_info, id = node->id]() {
+        auto db = connections->Reader();
+        return db.isOpen() ? AggregateEngine(db, tree_info).Total(id) : 0.0;
+    }).then(this, ShowTotal);
 }
 
 void MainWindow::on_treeView_clicked(const QModelIndex& index)
@@ -88,6 +193,9 @@ void MainWindow::on_treeView_clicked(const QModelIndex& index)
 
 void MainWindow::on_btnAppend_clicked()
 {
+    if (!financial_tree_model)
+        return;
+
     auto indexes = ui->treeView->selectionModel()->selectedRows();
 
     if (indexes.isEmpty())
@@ -103,22 +211,235 @@ void MainWindow::on_btnAppend_clicked()
 
 void MainWindow::on_treeView_doubleClicked(const QModelIndex& index)
 {
+    if (!index.isValid())
+        return;
+
     auto* node = static_cast<Node*>(index.internalPointer());
 
-    if (node->children.isEmpty()) {
+    // Nodes on the last summary level and placeholder rows have no loaded children either.
+    if (financial_tree_model->GetLeafPaths().Contains(node->id)) {
+        if (auto* table_view = table_views.value(node->id)) {
+            ui->tabWidget->setCurrentWidget(table_view);
+            return;
+        }
+
         auto* table_view = new QTableView();
-        auto table_info = TableInfo("financial_transaction", node->id);
-        auto* table_model = new TableModel(db, table_info, table_view);
-        auto* table_delegate = new ComboBoxDelegate(financial_tree_model->GetLeafPaths(), table_model);
+        auto* table_model = table_cache->Acquire(node->id);
+        table_model->setParent(table_view);
+        auto* table_delegate = new ComboBoxDelegate(financial_tree_model->GetLeafPaths(), table_view);
         connect(financial_tree_model, &TreeModel::LeafPaths, table_delegate, &ComboBoxDelegate::ReceiveLeafPaths);
+        connect(financial_tree_model, &TreeModel::LeafPathsChanged, table_delegate, &ComboBoxDelegate::PatchLeafPaths);
 
-        table_view->setItemDelegateForColumn(2, table_delegate);
+        table_view->setItemDelegateForColumn(1, table_delegate);
+        table_view->setItemDelegateForColumn(4, table_delegate);
         table_view->setModel(table_model);
         table_view->setSortingEnabled(true);
         table_view->horizontalHeader()->setStretchLastSection(true);
         table_view->setSelectionMode(QAbstractItemView::SingleSelection);
         table_view->setSelectionBehavior(QAbstractItemView::SelectRows);
+        new ViewportPrefetcher(table_view);
+
+        auto AddShortcut = [table_view](const QKeySequence& key, auto slot) {
+            auto* action = new QAction(table_view);
+            action->setShortcut(key);
+            action->setShortcutContext(Qt::WidgetShortcut);
+            connect(action, &QAction::triggered, table_view, slot);
+            table_view->addAction(action);
+        };
+
+        // New and pasted rows go below the current one, Delete removes it.
+        auto Below = [table_view, table_model]() {
+            auto current = table_view->currentIndex();
+            return current.isValid() ? current.row() + 1 : table_model->rowCount();
+        };
+
+        AddShortcut(QKeySequence(Qt::Key_Insert), [table_model, Below]() { table_model->insertRows(Below(), 1); });
+        AddShortcut(QKeySequence::Paste, [table_model, Below]() { table_model->Paste(Below(), QGuiApplication::clipboard()->text()); });
+        AddShortcut(QKeySequence::Delete, [table_view, table_model]() {
+            if (table_view->currentIndex().isValid())
+                table_model->removeRows(table_view->currentIndex().row(), 1);
+        });
+
+        ui->tabWidget->setCurrentIndex(ui->tabWidget->addTab(table_view, node->name));
+        table_views.insert(node->id, table_view);
 
-        ui->tabWidget->addTab(table_view, node->name);
+        auto ShowBalance = [this, table_view](double balance) {
+            ui->tabWidget->setTabToolTip(ui->tabWidget->indexOf(table_view), QString("Balance %1").arg(QLocale().toString(balance, 'f', 2)));
+        };
+
+        connect(table_model, &TableModel::BalanceChanged, table_view, ShowBalance);
+        ShowBalance(table_model->Balance());
+
+        table_cache->PrefetchSiblings(node);
     }
 }
+
+void MainWindow::CloseTab(int index)
+{
+    // Only account tabs close, their model goes back to the cache for the next double-click.
+    auto* table_view = qobject_cast<QTableView*>(ui->tabWidget->widget(index));
+    auto* table_model = table_view ? qobject_cast<TableModel*>(table_view->model()) : nullptr;
+
+    if (!table_model)
+        return;
+
+    table_views.remove(table_model->GetTableInfo().id_selected);
+    ui->tabWidget->removeTab(index);
+
+    table_view->setModel(nullptr);
+    table_cache->Release(table_model);
+    table_view->deleteLater();
+}
+
+void MainWindow::ImportAccounts()
+{
+    if (!financial_tree_model)
+        return;
+
+    auto file_name = QFileDialog::getOpenFileName(this, "Import Accounts", QString(), "CSV (*.csv)");
+    if (file_name.isEmpty())
+        return;
+
+    auto importer = Importer(db, financial_tree_model->GetTreeInfo());
+    if (importer.ImportAccounts(file_name))
+        tree_registry->Reload(financial_tree_model->GetTreeInfo().node);
+}
+
+void MainWindow::ImportTransactions()
+{
+    if (!financial_tree_model)
+        return;
+
+    auto file_name = QFileDialog::getOpenFileName(this, "Import Transactions", QString(), "CSV (*.csv)");
+    if (file_name.isEmpty())
+        return;
+
+    auto importer = Importer(db, financial_tree_model->GetTreeInfo());
+    importer.ImportTransactions(file_name);
+}
+
+void MainWindow::CheckTree()
+{
+    if (!financial_tree_model)
+        return;
+
+    auto tree_info = financial_tree_model->GetTreeInfo();
+
+    // Edits still queued would show up as differences between the graph and the table.
+    connection_manager->Writer()->Flush();
+
+    auto checker = ClosureChecker(db, tree_info);
+    auto violations = checker.Check(financial_tree_model->GetRoot());
+
+    if (violations.isEmpty()) {
+        QMessageBox::information(this, "Check Tree", "The tree is consistent.");
+        return;
+    }
+
+    QStringList lines;
+    for (int i = 0; i != qMin(violations.size(), 20); ++i)
+        lines << ClosureChecker::Describe(violations.at(i));
+
+    if (violations.size() > lines.size())
+        lines << QString("... and %1 more").arg(violations.size() - lines.size());
+
+    auto button = QMessageBox::warning(this, "Check Tree",
+        QString("%1 problems found:\n\n%2\n\nRebuild the paths from the parent relation?").arg(violations.size()).arg(lines.join('\n')),
+        QMessageBox::Yes | QMessageBox::No);
+
+    if (button != QMessageBox::Yes)
+        return;
+
+    // Through the writer like every other write, never next to it on this connection.
+    connection_manager->Writer()->Submit([tree_info](const QSqlDatabase& db, StatementCache& statements) {
+        Q_UNUSED(statements);
+        return ClosureChecker(db, tree_info).Rebuild() ? QVariant(true) : QVariant();
+    }).then(this, [this, node = tree_info.node](const QVariant& result) {
+        if (result.isValid())
+            tree_registry->Reload(node);
+    });
+}
+
+void MainWindow::ExportTrialBalance()
+{
+    if (!financial_tree_model || (report_engine && report_engine->IsRunning()))
+        return;
+
+    auto file_name = QFileDialog::getSaveFileName(this, "Export Trial Balance", QString(), "CSV (*.csv)");
+    if (file_name.isEmpty())
+        return;
+
+    if (!report_engine)
+        report_engine = new ReportEngine(connection_manager, financial_tree_model->GetTreeInfo(), this);
+
+    disconnect(report_engine, &ReportEngine::Finished, this, nullptr);
+    connect(report_engine, &ReportEngine::Finished, this, [this, file_name](const QList<ReportRow>& rows) {
+        if (ReportEngine::ExportCsv(file_name, rows))
+            ui->statusbar->showMessage(QString("Exported %1 accounts to %2").arg(rows.size()).arg(file_name), 5000);
+    });
+
+    ui->statusbar->showMessage("Building trial balance...");
+
+    // The summary view holds only the top levels, the report needs every account.
+    if (financial_tree_model->DepthLimit()) {
+        report_engine->RunFull();
+        return;
+    }
+
+    report_engine->Run(financial_tree_model->GetRoot());
+}
+
+void MainWindow::ExportBranch()
+{
+    if (!financial_tree_model)
+        return;
+
+    auto indexes = ui->treeView->selectionModel()->selectedRows();
+    if (indexes.isEmpty())
+        return;
+
+    auto file_name = QFileDialog::getSaveFileName(this, "Export Branch", QString(), "Subtree (*.jsonl)");
+    if (file_name.isEmpty())
+        return;
+
+    // A failed export leaves an existing file as it was.
+    QSaveFile file(file_name);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning() << "Failed to write" << file_name << file.errorString();
+        return;
+    }
+
+    if (!financial_tree_model->ExportSubtrees(indexes, &file, true) || !file.commit())
+        QMessageBox::warning(this, "Export Branch", QString("Failed to write %1: %2").arg(file_name, file.errorString()));
+}
+
+void MainWindow::SummaryLevels()
+{
+    if (!financial_tree_model)
+        return;
+
+    bool ok = false;
+    int depth = QInputDialog::getInt(this, "Summary Levels", "Levels to load, 0 for the whole tree:",
+        financial_tree_model->DepthLimit(), 0, 64, 1, &ok);
+
+    if (ok)
+        financial_tree_model->SetDepthLimit(depth);
+}
+
+void MainWindow::ImportBranch()
+{
+    if (!financial_tree_model)
+        return;
+
+    auto file_name = QFileDialog::getOpenFileName(this, "Import Branch", QString(), "Subtree (*.jsonl)");
+    if (file_name.isEmpty())
+        return;
+
+    QFile file(file_name);
+    if (!file.open(QIODevice::ReadOnly)) {
+        qWarning() << "Failed to open" << file_name << file.errorString();
+        return;
+    }
+
+    financial_tree_model->ImportSubtrees(&file, ui->treeView->currentIndex());
+}
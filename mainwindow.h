@@ -1,9 +1,15 @@
 ﻿#ifndef MAINWINDOW_H
 #define MAINWINDOW_H
+#include "aggregateengine.h"
+#include "connectionmanager.h"
+#include "reportengine.h"
+#include "tablecache.h"
 #include "tablemodel.h"
 #include "treemodel.h"
+#include "treeregistry.h"
 #include "ui_mainwindow.h"
 #include <QMainWindow>
+#include <QTableView>
 
 QT_BEGIN_NAMESPACE
 namespace Ui {
@@ -32,10 +38,26 @@ private slots:
 
     void on_treeView_doubleClicked(const QModelIndex& index);
 
+    void ImportAccounts();
+    void ImportTransactions();
+    void CheckTree();
+    void ExportTrialBalance();
+    void ExportBranch();
+    void ImportBranch();
+    void SummaryLevels();
+    void CloseTab(int index);
+
+    void TreeLoaded(TreeModel* model);
+
 private:
     Ui::MainWindow* ui;
 
-    TreeModel* financial_tree_model;
+    ConnectionManager* connection_manager { nullptr };
+    TreeRegistry* tree_registry { nullptr };
+    TreeModel* financial_tree_model { nullptr };
+    ReportEngine* report_engine { nullptr };
+    TableCache* table_cache { nullptr };
+    QHash<int, QTableView*> table_views; // open account tabs
 
     QSqlDatabase db;
 };
@@ -0,0 +1,222 @@
+#include "profiler.h"
+#include <QAbstractItemModel>
+#include <QCoreApplication>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMutex>
+#include <QThread>
+#include <QTimer>
+
+namespace {
+QElapsedTimer trace_clock;
+QMutex mutex;
+QJsonArray events;
+QString path;
+
+const int kFrameInterval = 16;
+const int kMaxEvents = 1000000;
+
+qint64 ThreadId()
+{
+    return reinterpret_cast<qint64>(QThread::currentThreadId());
+}
+}
+
+bool Profiler::enabled { false };
+int Profiler::counters[static_cast<int>(Counter::kCount)] {};
+
+bool Profiler::Enable(const QString& trace_path)
+{
+    if (enabled || trace_path.isEmpty())
+        return false;
+
+    path = trace_path;
+    trace_clock.start();
+    enabled = true;
+
+    auto* timer = new QTimer(QCoreApplication::instance());
+    QObject::connect(timer, &QTimer::timeout, &Profiler::Frame);
+    timer->start(kFrameInterval);
+
+    return true;
+}
+
+void Profiler::Watch(const QAbstractItemModel* model)
+{
+    if (!enabled || !model)
+        return;
+
+    auto Emitted = [] { Count(Counter::kSignal); };
+
+    QObject::connect(model, &QAbstractItemModel::dataChanged, model, Emitted);
+    QObject::connect(model, &QAbstractItemModel::rowsInserted, model, Emitted);
+    QObject::connect(model, &QAbstractItemModel::rowsRemoved, model, Emitted);
+    QObject::connect(model, &QAbstractItemModel::rowsMoved, model, Emitted);
+    QObject::connect(model, &QAbstractItemModel::layoutChanged, model, Emitted);
+    QObject::connect(model, &QAbstractItemModel::modelReset, model, Emitted);
+}
+
+void Profiler::Frame()
+{
+    if (!enabled)
+        return;
+
+    int total = 0;
+    for (int count : counters)
+        total += count;
+
+    if (total == 0)
+        return;
+
+    QJsonObject args;
+    args["data"] = counters[static_cast<int>(Counter::kData)];
+    args["index"] = counters[static_cast<int>(Counter::kIndex)];
+    args["parent"] = counters[static_cast<int>(Counter::kParent)];
+    args["signal"] = counters[static_cast<int>(Counter::kSignal)];
+
+    for (int& count : counters)
+        count = 0;
+
+    QJsonObject event;
+    event["name"] = "model";
+    event["ph"] = "C";
+    event["ts"] = Now();
+    event["pid"] = 1;
+    event["args"] = args;
+
+    QMutexLocker locker(&mutex);
+    if (events.size() < kMaxEvents)
+        events.append(event);
+}
+
+void Profiler::Record(const QString& statement, qint64 begin, qint64 duration, int rows)
+{
+    if (!enabled)
+        return;
+
+    QJsonObject args;
+    args["statement"] = statement;
+    args["rows"] = rows;
+
+    QJsonObject event;
+    event["name"] = statement.section(' ', 0, 0, QString::SectionSkipEmpty).toUpper();
+    event["cat"] = "sql";
+    event["ph"] = "X";
+    event["ts"] = begin;
+    event["dur"] = duration;
+    event["pid"] = 1;
+    event["tid"] = ThreadId();
+    event["args"] = args;
+
+    QMutexLocker locker(&mutex);
+    if (events.size() < kMaxEvents)
+        events.append(event);
+}
+
+bool Profiler::Write()
+{
+    if (!enabled)
+        return false;
+
+    Frame();
+
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qWarning() << "Failed to open trace file" << path << file.errorString();
+        return false;
+    }
+
+    QJsonObject root;
+    {
+        QMutexLocker locker(&mutex);
+        root["traceEvents"] = events;
+    }
+    root["displayTimeUnit"] = "ms";
+
+    file.write(QJsonDocument(root).toJson(QJsonDocument::Compact));
+    return true;
+}
+
+qint64 Profiler::Now()
+{
+    return trace_clock.nsecsElapsed() / 1000;
+}
+
+SqlTrace::SqlTrace(QSqlQuery& query)
+    : query { query }
+{
+}
+
+SqlTrace::~SqlTrace()
+{
+    Finish();
+}
+
+bool SqlTrace::Exec()
+{
+    if (!Profiler::IsEnabled())
+        return query.exec();
+
+    Finish();
+
+    statement = query.lastQuery();
+    begin = Profiler::Now();
+    rows = 0;
+
+    bool result = query.exec();
+
+    pending = true;
+
+    if (!result || !query.isSelect()) {
+        rows = query.numRowsAffected();
+        Finish();
+    }
+
+    return result;
+}
+
+bool SqlTrace::ExecBatch()
+{
+    if (!Profiler::IsEnabled())
+        return query.execBatch();
+
+    Finish();
+
+    statement = query.lastQuery();
+    begin = Profiler::Now();
+
+    bool result = query.execBatch();
+
+    rows = query.numRowsAffected();
+    pending = true;
+    Finish();
+
+    return result;
+}
+
+bool SqlTrace::Next()
+{
+    bool result = query.next();
+
+    if (pending) {
+        if (result)
+            ++rows;
+        else
+            Finish();
+    }
+
+    return result;
+}
+
+void SqlTrace::Finish()
+{
+    if (!pending)
+        return;
+
+    pending = false;
+    Profiler::Record(statement, begin, Profiler::Now() - begin, rows);
+}
@@ -0,0 +1,67 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <QSqlQuery>
+#include <QString>
+
+class QAbstractItemModel;
+
+// Opt-in instrumentation, enabled by setting TREEMODEL_TRACE to an output path.
+// SQL statements are recorded as complete events, model calls and signal emissions
+// as per-frame counters, and everything is written as a Chrome trace JSON file
+// (load it in chrome://tracing or https://ui.perfetto.dev).
+
+enum class Counter {
+    kData,
+    kIndex,
+    kParent,
+    kSignal,
+    kCount
+};
+
+class Profiler {
+public:
+    static bool Enable(const QString& trace_path);
+    static bool IsEnabled() { return enabled; }
+
+    static void Count(Counter counter)
+    {
+        if (enabled)
+            ++counters[static_cast<int>(counter)];
+    }
+
+    static void Watch(const QAbstractItemModel* model);
+    static void Frame();
+    static void Record(const QString& statement, qint64 begin, qint64 duration, int rows);
+    static bool Write();
+
+    static qint64 Now();
+
+private:
+    static bool enabled;
+    static int counters[static_cast<int>(Counter::kCount)];
+};
+
+// Times one statement on query, from Exec() until the last row is fetched.
+class SqlTrace {
+public:
+    explicit SqlTrace(QSqlQuery& query);
+    ~SqlTrace();
+
+    bool Exec();
+    bool ExecBatch();
+    bool Next();
+
+private:
+    void Finish();
+
+private:
+    QSqlQuery& query;
+    QString statement;
+
+    qint64 begin { 0 };
+    int rows { 0 };
+    bool pending { false };
+};
+
+#endif // PROFILER_H
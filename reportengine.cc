@@ -0,0 +1,230 @@
+#include "reportengine.h"
+#include "profiler.h"
+#include "connectionmanager.h"
+#include "treeloader.h"
+#include <QDebug>
+#include <QSaveFile>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QTextStream>
+#include <QtConcurrent>
+
+namespace {
+struct Sums {
+    double debit { 0.0 };
+    double credit { 0.0 };
+};
+
+using Partial = QHash<int, Sums>;
+
+struct Chunk {
+    ConnectionManager* connections;
+    QString transaction;
+    qint64 first { 0 };
+    qint64 last { 0 };
+    QDate to;
+};
+
+Partial ScanChunk(const Chunk& chunk)
+{
+    Partial partial;
+
+    {
+        auto db = chunk.connections->Reader();
+        auto query = QSqlQuery(db);
+        SqlTrace trace(query);
+        query.setForwardOnly(true);
+
+        query.prepare(QString("SELECT source, target, debit, credit FROM %1 "
+                              "WHERE id BETWEEN :first AND :last AND (:to IS NULL OR date <= :to)")
+                          .arg(chunk.transaction));
+        query.bindValue(":first", chunk.first);
+        query.bindValue(":last", chunk.last);
+        query.bindValue(":to", chunk.to.isValid() ? QVariant(chunk.to.toString(Qt::ISODate)) : QVariant());
+
+        if (db.isOpen() && trace.Exec()) {
+            while (trace.Next()) {
+                double debit = query.value(2).toDouble();
+                double credit = query.value(3).toDouble();
+
+                Sums& source = partial[query.value(0).toInt()];
+                source.debit += debit;
+                source.credit += credit;
+
+                Sums& target = partial[query.value(1).toInt()];
+                target.debit += credit;
+                target.credit += debit;
+            }
+        } else {
+            qWarning() << "Error scanning transactions" << chunk.first << chunk.last << query.lastError().text();
+        }
+    }
+
+    return partial;
+}
+
+void Merge(Partial& result, const Partial& partial)
+{
+    for (auto it = partial.cbegin(); it != partial.cend(); ++it) {
+        Sums& sums = result[it.key()];
+        sums.debit += it->debit;
+        sums.credit += it->credit;
+    }
+}
+
+QString CsvField(const QString& field)
+{
+    if (!field.contains(',') && !field.contains('"') && !field.contains('\n'))
+        return field;
+
+    return '"' + QString(field).replace("\"", "\"\"") + '"';
+}
+}
+
+ReportEngine::ReportEngine(ConnectionManager* connections, const TreeInfo& tree_info, QObject* parent)
+    : QObject { parent }
+    , connections { connections }
+    , tree_info { tree_info }
+    , watcher { new QFutureWatcher<QList<ReportRow>>(this) }
+{
+    connect(watcher, &QFutureWatcher<QList<ReportRow>>::finished, this, [this]() {
+        emit Finished(watcher->result());
+    });
+}
+
+ReportEngine::~ReportEngine()
+{
+    watcher->waitForFinished();
+}
+
+void ReportEngine::Run(const Node* root, const QDate& to)
+{
+    if (IsRunning() || tree_info.transaction.isEmpty())
+        return;
+
+    watcher->setFuture(QtConcurrent::run(&TrialBalance, connections, tree_info, Flatten(root), to, &pool, QChar('/')));
+}
+
+void ReportEngine::RunFull(const QDate& to)
+{
+    if (IsRunning() || tree_info.transaction.isEmpty())
+        return;
+
+    watcher->setFuture(QtConcurrent::run([connections = connections, tree_info = tree_info, to, pool = &pool]() {
+        Hierarchy hierarchy;
+
+        {
+            QHash<int, Node*> nodes;
+            Node* root = TreeLoader::ConstructTree(connections->Reader(), tree_info, nodes, nullptr);
+            hierarchy = Flatten(root);
+            delete root;
+        }
+
+        return TrialBalance(connections, tree_info, hierarchy, to, pool, QChar('/'));
+    }));
+}
+
+bool ReportEngine::IsRunning() const
+{
+    return watcher->isRunning();
+}
+
+ReportEngine::Hierarchy ReportEngine::Flatten(const Node* root)
+{
+    Hierarchy hierarchy;
+
+    std::function<void(const Node*, int)> Visit = [&hierarchy, &Visit](const Node* node, int parent) {
+        for (const Node* child : node->children) {
+            hierarchy.ids << child->id;
+            hierarchy.parents << parent;
+            hierarchy.names << child->name;
+
+            Visit(child, hierarchy.ids.size() - 1);
+        }
+    };
+
+    Visit(root, -1);
+    return hierarchy;
+}
+
+QList<ReportRow> ReportEngine::TrialBalance(ConnectionManager* connections, const TreeInfo& tree_info,
+    const Hierarchy& hierarchy, const QDate& to, QThreadPool* pool, QChar separator)
+{
+    QList<ReportRow> rows;
+    QList<Chunk> chunks;
+
+    {
+        auto db = connections->Reader();
+        auto query = QSqlQuery(db);
+        SqlTrace trace(query);
+
+        query.prepare(QString("SELECT MIN(id), MAX(id) FROM %1").arg(tree_info.transaction));
+
+        if (db.isOpen() && trace.Exec() && trace.Next() && !query.value(0).isNull()) {
+            qint64 first = query.value(0).toLongLong();
+            qint64 last = query.value(1).toLongLong();
+            qint64 count = qMax(1, pool->maxThreadCount() * 4);
+            qint64 size = qMax<qint64>(1, (last - first + count) / count);
+
+            for (qint64 begin = first; begin <= last; begin += size)
+                chunks << Chunk { connections, tree_info.transaction, begin, qMin(last, begin + size - 1), to };
+        }
+    }
+
+    Partial totals = QtConcurrent::blockingMappedReduced<Partial>(pool, chunks, ScanChunk, Merge);
+
+    int size = hierarchy.ids.size();
+    QVector<Sums> sums(size);
+
+    for (int i = 0; i != size; ++i)
+        sums[i] = totals.value(hierarchy.ids.at(i));
+
+    // Children follow their parent in pre-order, walking backwards finishes every subtree
+    // before its root is added to the parent.
+    for (int i = size - 1; i >= 0; --i) {
+        int parent = hierarchy.parents.at(i);
+        if (parent < 0)
+            continue;
+
+        sums[parent].debit += sums.at(i).debit;
+        sums[parent].credit += sums.at(i).credit;
+    }
+
+    QVector<QString> paths(size);
+    QVector<int> depths(size);
+    rows.reserve(size);
+
+    for (int i = 0; i != size; ++i) {
+        int parent = hierarchy.parents.at(i);
+
+        paths[i] = parent < 0 ? hierarchy.names.at(i) : paths.at(parent) + separator + hierarchy.names.at(i);
+        depths[i] = parent < 0 ? 0 : depths.at(parent) + 1;
+
+        rows << ReportRow { hierarchy.ids.at(i), depths.at(i), paths.at(i),
+            sums.at(i).debit, sums.at(i).credit, sums.at(i).debit - sums.at(i).credit };
+    }
+
+    return rows;
+}
+
+bool ReportEngine::ExportCsv(const QString& file_name, const QList<ReportRow>& rows)
+{
+    QSaveFile file(file_name);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+        qWarning() << "Failed to write report" << file_name << file.errorString();
+        return false;
+    }
+
+    QTextStream stream(&file);
+    stream << "id,path,depth,debit,credit,balance\n";
+
+    for (const auto& row : rows) {
+        stream << row.id << ',' << CsvField(row.path) << ',' << row.depth << ','
+               << QString::number(row.debit, 'f', 2) << ','
+               << QString::number(row.credit, 'f', 2) << ','
+               << QString::number(row.balance, 'f', 2) << '\n';
+    }
+
+    stream.flush();
+    return file.commit();
+}
@@ -0,0 +1,63 @@
+#ifndef REPORTENGINE_H
+#define REPORTENGINE_H
+
+#include "tree.h"
+#include <QDate>
+#include <QFutureWatcher>
+#include <QObject>
+#include <QThreadPool>
+
+class ConnectionManager;
+
+struct ReportRow {
+    int id { 0 };
+    int depth { 0 };
+    QString path;
+    double debit { 0.0 };
+    double credit { 0.0 };
+    double balance { 0.0 };
+};
+
+// Trial balance with subtree roll-ups. The hierarchy is copied from the model on the GUI
+// thread, or read from the closure table by the task itself when the model holds only the
+// top levels. The rest runs on the thread pool: the transaction table is split into rowid
+// ranges scanned on separate connections, every range sums per account, the partial sums
+// are merged and rolled up bottom-up in one reverse pre-order pass. Pool threads read
+// through their own connections of the connection manager.
+
+class ReportEngine : public QObject {
+    Q_OBJECT
+
+public:
+    struct Hierarchy {
+        QVector<int> ids;
+        QVector<int> parents; // index into ids, -1 at top level
+        QVector<QString> names;
+    };
+
+    ReportEngine(ConnectionManager* connections, const TreeInfo& tree_info, QObject* parent = nullptr);
+    ~ReportEngine();
+
+    // Includes transactions dated up to and including to, all of them when to is null.
+    void Run(const Node* root, const QDate& to = QDate());
+    // Every account of the tree, the hierarchy is loaded on a reader connection.
+    void RunFull(const QDate& to = QDate());
+    bool IsRunning() const;
+
+    static Hierarchy Flatten(const Node* root);
+    static QList<ReportRow> TrialBalance(ConnectionManager* connections, const TreeInfo& tree_info,
+        const Hierarchy& hierarchy, const QDate& to, QThreadPool* pool, QChar separator = '/');
+    static bool ExportCsv(const QString& file_name, const QList<ReportRow>& rows);
+
+signals:
+    void Finished(const QList<ReportRow>& rows);
+
+private:
+    ConnectionManager* connections { nullptr };
+    TreeInfo tree_info;
+
+    QThreadPool pool;
+    QFutureWatcher<QList<ReportRow>>* watcher;
+};
+
+#endif // REPORTENGINE_H
@@ -0,0 +1,578 @@
+#include "schema.h"
+#include "profiler.h"
+#include "sqlconnection.h"
+#include <QDebug>
+#include <QSqlError>
+#include <QSqlQuery>
+
+namespace {
+using Migration = QStringList (*)(const TreeInfo&);
+
+QStringList Indexes(const TreeInfo& tree_info)
+{
+    QStringList indexes;
+
+    indexes << QString("%1_name_index ON %1 (name)").arg(tree_info.node)
+            << QString("%1_descendant_index ON %1 (descendant, ancestor, distance)").arg(tree_info.node_path)
+            << QString("%1_ancestor_index ON %1 (ancestor, distance)").arg(tree_info.node_path);
+
+    return indexes;
+}
+
+// (account, date) serves lookups by account as well as the delta scans of BalanceAt,
+// the single column indexes of version 2 are dropped by version 6.
+QStringList PostingIndexes(const TreeInfo& tree_info)
+{
+    QStringList indexes;
+
+    if (!tree_info.transaction.isEmpty()) {
+        indexes << QString("%1_source_date_index ON %1 (source, date)").arg(tree_info.transaction)
+                << QString("%1_target_date_index ON %1 (target, date)").arg(tree_info.transaction);
+    }
+
+    return indexes;
+}
+
+// Indexes of tables added by later steps, kept apart so earlier steps never see them.
+QStringList DimensionIndexes(const TreeInfo& tree_info)
+{
+    QStringList indexes;
+
+    if (!tree_info.transaction.isEmpty())
+        indexes << QString("%1_dimension_node_index ON %1_dimension (dimension, node)").arg(tree_info.transaction);
+
+    return indexes;
+}
+
+QStringList CreateTables(const TreeInfo& tree_info)
+{
+    QStringList statements;
+
+    statements << QString("CREATE TABLE IF NOT EXISTS %1 ("
+                          "id INTEGER PRIMARY KEY AUTOINCREMENT, "
+                          "name TEXT NOT NULL, "
+                          "description TEXT DEFAULT NULL)")
+                      .arg(tree_info.node)
+               << QString("CREATE TABLE IF NOT EXISTS %1 ("
+                          "id INTEGER PRIMARY KEY AUTOINCREMENT, "
+                          "ancestor INTEGER NOT NULL, "
+                          "descendant INTEGER NOT NULL, "
+                          "distance TINYINT NOT NULL CHECK (distance >= 0), "
+                          "FOREIGN KEY (ancestor) REFERENCES %2(id), "
+                          "FOREIGN KEY (descendant) REFERENCES %2(id), "
+                          "UNIQUE (ancestor, descendant))")
+                      .arg(tree_info.node_path, tree_info.node)
+               << QString("CREATE INDEX IF NOT EXISTS %1_name_index ON %1 (name)").arg(tree_info.node);
+
+    if (!tree_info.transaction.isEmpty()) {
+        statements << QString("CREATE TABLE IF NOT EXISTS %1 ("
+                              "id INTEGER PRIMARY KEY AUTOINCREMENT, "
+                              "source INTEGER NOT NULL, "
+                              "note TEXT DEFAULT NULL, "
+                              "description TEXT DEFAULT NULL, "
+                              "target INTEGER NOT NULL, "
+                              "debit MONEY DEFAULT NULL, "
+                              "credit MONEY DEFAULT NULL, "
+                              "FOREIGN KEY (source) REFERENCES %2(id), "
+                              "FOREIGN KEY (target) REFERENCES %2(id))")
+                          .arg(tree_info.transaction, tree_info.node);
+    }
+
+    return statements;
+}
+
+QStringList IndexStatements(const TreeInfo& tree_info)
+{
+    QStringList statements;
+
+    for (const QString& index : Indexes(tree_info))
+        statements << QString("CREATE INDEX IF NOT EXISTS %1").arg(index);
+
+    if (!tree_info.transaction.isEmpty()) {
+        statements << QString("CREATE INDEX IF NOT EXISTS %1_source_index ON %1 (source)").arg(tree_info.transaction)
+                   << QString("CREATE INDEX IF NOT EXISTS %1_target_index ON %1 (target)").arg(tree_info.transaction);
+    }
+
+    return statements;
+}
+
+// Bumps tree_version on every row change of the node and node path tables,
+// snapshots and caches compare against it to detect stale data.
+QStringList VersionTriggers(const TreeInfo& tree_info)
+{
+    QStringList statements;
+
+    for (const QString& table : { tree_info.node, tree_info.node_path }) {
+        for (const QString& operation : { "INSERT", "UPDATE", "DELETE" }) {
+            statements << QString("CREATE TRIGGER IF NOT EXISTS %1_version_%2 AFTER %3 ON %1 "
+                                  "BEGIN UPDATE tree_version SET version = version + 1 WHERE name = '%4'; END")
+                              .arg(table, operation.toLower(), operation, tree_info.node);
+        }
+    }
+
+    return statements;
+}
+
+// Logs every node change and every change of a direct parent to tree_change,
+// TreeModel replays the log to pick up writes from other connections.
+QStringList ChangeTriggers(const TreeInfo& tree_info)
+{
+    QStringList statements;
+
+    auto Trigger = [&tree_info](const QString& table, const QString& event, const QString& when, const QString& row, const QString& operation) {
+        return QString("CREATE TRIGGER IF NOT EXISTS %1_change_%2 AFTER %3 ON %1 %4"
+                       "BEGIN INSERT INTO tree_change (name, row, operation) VALUES ('%5', %6, '%7'); END")
+            .arg(table, event.toLower(), event, when, tree_info.node, row, operation);
+    };
+
+    statements << Trigger(tree_info.node, "INSERT", "", "NEW.id", "insert")
+               << Trigger(tree_info.node, "UPDATE", "", "NEW.id", "update")
+               << Trigger(tree_info.node, "DELETE", "", "OLD.id", "delete")
+               << Trigger(tree_info.node_path, "INSERT", "WHEN NEW.distance = 1 ", "NEW.descendant", "move")
+               << Trigger(tree_info.node_path, "UPDATE", "WHEN NEW.distance = 1 OR OLD.distance = 1 ", "NEW.descendant", "move")
+               << Trigger(tree_info.node_path, "DELETE", "WHEN OLD.distance = 1 ", "OLD.descendant", "move");
+
+    return statements;
+}
+
+// Transactions and their dimension mappings bump the version row of the transaction table,
+// AggregateEngine drops cached totals when it moves.
+QStringList DimensionTriggers(const TreeInfo& tree_info)
+{
+    QStringList statements;
+
+    if (tree_info.transaction.isEmpty())
+        return statements;
+
+    for (const QString& table : { tree_info.transaction, tree_info.transaction + "_dimension" }) {
+        for (const QString& operation : { "INSERT", "UPDATE", "DELETE" }) {
+            statements << QString("CREATE TRIGGER IF NOT EXISTS %1_version_%2 AFTER %3 ON %1 "
+                                  "BEGIN UPDATE tree_version SET version = version + 1 WHERE name = '%4'; END")
+                              .arg(table, operation.toLower(), operation, tree_info.transaction);
+        }
+    }
+
+    return statements;
+}
+
+// Bumps the version of every account a transaction is posted from or to, before and after
+// the change. TableCache compares it to tell a stale account from the ones left alone.
+QStringList AccountVersionTriggers(const TreeInfo& tree_info)
+{
+    QStringList statements;
+
+    if (tree_info.transaction.isEmpty())
+        return statements;
+
+    auto Bump = [&tree_info](const QString& row) {
+        QString statements;
+
+        for (const QString& account : { row + ".source", row + ".target" })
+            statements += QString("INSERT INTO %1_account_version (account, version) VALUES (%2, 1) "
+                                  "ON CONFLICT (account) DO UPDATE SET version = version + 1; ")
+                              .arg(tree_info.transaction, account);
+
+        return statements;
+    };
+
+    statements << QString("CREATE TRIGGER IF NOT EXISTS %1_account_version_insert AFTER INSERT ON %1 BEGIN %2END")
+                      .arg(tree_info.transaction, Bump("NEW"))
+               << QString("CREATE TRIGGER IF NOT EXISTS %1_account_version_update AFTER UPDATE ON %1 BEGIN %2%3END")
+                      .arg(tree_info.transaction, Bump("OLD"), Bump("NEW"))
+               << QString("CREATE TRIGGER IF NOT EXISTS %1_account_version_delete AFTER DELETE ON %1 BEGIN %2END")
+                      .arg(tree_info.transaction, Bump("OLD"));
+
+    return statements;
+}
+
+// Keeps <transaction>_balance equal to the net movement of every account in every month.
+// An edit reverses the old posting and applies the new one, two upserts per side.
+QStringList BalanceTriggers(const TreeInfo& tree_info)
+{
+    QStringList statements;
+
+    if (tree_info.transaction.isEmpty())
+        return statements;
+
+    auto Post = [&tree_info](const QString& row, const QString& sign) {
+        auto Upsert = [&tree_info](const QString& account, const QString& date, const QString& amount) {
+            return QString("INSERT INTO %1_balance (account, period, amount) VALUES (%2, substr(%3, 1, 7), %4) "
+                           "ON CONFLICT (account, period) DO UPDATE SET amount = amount + excluded.amount; ")
+                .arg(tree_info.transaction, account, date, amount);
+        };
+
+        auto Debit = QString("COALESCE(%1.debit, 0)").arg(row);
+        auto Credit = QString("COALESCE(%1.credit, 0)").arg(row);
+        auto Source = sign == "+" ? Debit + " - " + Credit : Credit + " - " + Debit;
+        auto Target = sign == "+" ? Credit + " - " + Debit : Debit + " - " + Credit;
+
+        return Upsert(row + ".source", row + ".date", Source) + Upsert(row + ".target", row + ".date", Target);
+    };
+
+    statements << QString("CREATE TRIGGER IF NOT EXISTS %1_balance_insert AFTER INSERT ON %1 BEGIN %2END")
+                      .arg(tree_info.transaction, Post("NEW", "+"))
+               << QString("CREATE TRIGGER IF NOT EXISTS %1_balance_update AFTER UPDATE OF source, target, debit, credit, date ON %1 BEGIN %2%3END")
+                      .arg(tree_info.transaction, Post("OLD", "-"), Post("NEW", "+"))
+               << QString("CREATE TRIGGER IF NOT EXISTS %1_balance_delete AFTER DELETE ON %1 BEGIN %2END")
+                      .arg(tree_info.transaction, Post("OLD", "-"));
+
+    return statements;
+}
+
+// Transaction dates compare as text, so they are kept as YYYY-MM-DD. SQLite cannot add a
+// CHECK to an existing column, these reject any date that date() does not return unchanged.
+QStringList DateTriggers(const TreeInfo& tree_info)
+{
+    QStringList statements;
+
+    if (tree_info.transaction.isEmpty())
+        return statements;
+
+    statements << QString("CREATE TRIGGER IF NOT EXISTS %1_date_insert BEFORE INSERT ON %1 "
+                          "WHEN NEW.date IS NOT date(NEW.date) "
+                          "BEGIN SELECT RAISE(ABORT, 'date is not YYYY-MM-DD'); END")
+                      .arg(tree_info.transaction)
+               << QString("CREATE TRIGGER IF NOT EXISTS %1_date_update BEFORE UPDATE OF date ON %1 "
+                          "WHEN NEW.date IS NOT date(NEW.date) "
+                          "BEGIN SELECT RAISE(ABORT, 'date is not YYYY-MM-DD'); END")
+                      .arg(tree_info.transaction);
+
+    return statements;
+}
+
+// Recomputes <transaction>_balance from the ledger, used by the migration and after bulk loads.
+QStringList BalanceStatements(const TreeInfo& tree_info)
+{
+    QStringList statements;
+
+    if (tree_info.transaction.isEmpty())
+        return statements;
+
+    statements << QString("DELETE FROM %1_balance").arg(tree_info.transaction)
+               << QString("INSERT INTO %1_balance (account, period, amount) "
+                          "SELECT account, period, SUM(amount) FROM ("
+                          "SELECT source AS account, substr(date, 1, 7) AS period, COALESCE(debit, 0) - COALESCE(credit, 0) AS amount FROM %1 "
+                          "UNION ALL "
+                          "SELECT target, substr(date, 1, 7), COALESCE(credit, 0) - COALESCE(debit, 0) FROM %1"
+                          ") GROUP BY account, period")
+                      .arg(tree_info.transaction);
+
+    return statements;
+}
+
+QStringList CreateVersionTriggers(const TreeInfo& tree_info)
+{
+    QStringList statements;
+
+    statements << "CREATE TABLE IF NOT EXISTS tree_version ("
+                  "name TEXT PRIMARY KEY, "
+                  "version INTEGER NOT NULL DEFAULT 0)"
+               << QString("INSERT OR IGNORE INTO tree_version (name) VALUES ('%1')").arg(tree_info.node)
+               << VersionTriggers(tree_info);
+
+    return statements;
+}
+
+QStringList CreateChangeTriggers(const TreeInfo& tree_info)
+{
+    QStringList statements;
+
+    statements << "CREATE TABLE IF NOT EXISTS tree_change ("
+                  "seq INTEGER PRIMARY KEY AUTOINCREMENT, "
+                  "name TEXT NOT NULL, "
+                  "row INTEGER NOT NULL, "
+                  "operation TEXT NOT NULL)"
+               << ChangeTriggers(tree_info);
+
+    return statements;
+}
+
+// Maps a transaction to any number of nodes of other trees, "dimension" is the node table
+// of that tree. A transaction may be split over several cost centres or projects.
+QStringList CreateDimensions(const TreeInfo& tree_info)
+{
+    QStringList statements;
+
+    if (tree_info.transaction.isEmpty())
+        return statements;
+
+    statements << QString("CREATE TABLE IF NOT EXISTS %1_dimension ("
+                          "transaction_id INTEGER NOT NULL, "
+                          "dimension TEXT NOT NULL, "
+                          "node INTEGER NOT NULL, "
+                          "PRIMARY KEY (transaction_id, dimension, node), "
+                          "FOREIGN KEY (transaction_id) REFERENCES %1(id)) WITHOUT ROWID")
+                      .arg(tree_info.transaction)
+               << QString("INSERT OR IGNORE INTO tree_version (name) VALUES ('%1')").arg(tree_info.transaction);
+
+    for (const QString& index : DimensionIndexes(tree_info))
+        statements << QString("CREATE INDEX IF NOT EXISTS %1").arg(index);
+
+    statements << DimensionTriggers(tree_info);
+
+    return statements;
+}
+
+// Dates transactions (ISO 8601, undated rows count as opening balances) and adds the
+// per-account, per-month balance table maintained by BalanceTriggers.
+QStringList CreateBalances(const TreeInfo& tree_info)
+{
+    QStringList statements;
+
+    if (tree_info.transaction.isEmpty())
+        return statements;
+
+    statements << QString("ALTER TABLE %1 ADD COLUMN date TEXT NOT NULL DEFAULT '1970-01-01'").arg(tree_info.transaction)
+               << QString("DROP INDEX IF EXISTS %1_source_index").arg(tree_info.transaction)
+               << QString("DROP INDEX IF EXISTS %1_target_index").arg(tree_info.transaction)
+               << QString("CREATE TABLE IF NOT EXISTS %1_balance ("
+                          "account INTEGER NOT NULL, "
+                          "period TEXT NOT NULL, "
+                          "amount REAL NOT NULL DEFAULT 0, "
+                          "PRIMARY KEY (account, period)) WITHOUT ROWID")
+                      .arg(tree_info.transaction);
+
+    for (const QString& index : PostingIndexes(tree_info))
+        statements << QString("CREATE INDEX IF NOT EXISTS %1").arg(index);
+
+    statements << BalanceStatements(tree_info) << BalanceTriggers(tree_info);
+
+    return statements;
+}
+
+// Rewrites the dates date() can read to YYYY-MM-DD, the rest become undated, then
+// rebuilds the balances of the moved months and guards the column from now on.
+QStringList NormaliseDates(const TreeInfo& tree_info)
+{
+    QStringList statements;
+
+    if (tree_info.transaction.isEmpty())
+        return statements;
+
+    statements << QString("UPDATE %1 SET date = COALESCE(date(date), '1970-01-01') WHERE date IS NOT date(date)")
+                      .arg(tree_info.transaction)
+               << BalanceStatements(tree_info) << DateTriggers(tree_info);
+
+    return statements;
+}
+
+// Versions per account next to the one of the whole transaction table, account 0 stands for
+// all of them and is bumped by bulk loads, which run without triggers.
+QStringList CreateAccountVersions(const TreeInfo& tree_info)
+{
+    QStringList statements;
+
+    if (tree_info.transaction.isEmpty())
+        return statements;
+
+    statements << QString("CREATE TABLE IF NOT EXISTS %1_account_version ("
+                          "account INTEGER PRIMARY KEY, "
+                          "version INTEGER NOT NULL DEFAULT 0)")
+                      .arg(tree_info.transaction)
+               << AccountVersionTriggers(tree_info);
+
+    return statements;
+}
+
+// Append new steps at the end, the position in this list is the schema version.
+const QList<Migration> kMigrations {
+    CreateTables,
+    IndexStatements,
+    CreateVersionTriggers,
+    CreateChangeTriggers,
+    CreateDimensions,
+    CreateBalances,
+    NormaliseDates,
+    CreateAccountVersions,
+};
+}
+
+bool Schema::Migrate(QSqlDatabase& db, const TreeInfo& tree_info)
+{
+    if (!SqlConnection::Exec(db, "CREATE TABLE IF NOT EXISTS schema_version ("
+                                 "name TEXT PRIMARY KEY, "
+                                 "version INTEGER NOT NULL)"))
+        return false;
+
+    int version = Version(db, tree_info.node);
+
+    for (int i = version; i < kMigrations.size(); ++i) {
+        // Without it every statement would commit on its own and a failing step be left half done.
+        if (!db.transaction()) {
+            qWarning() << "Failed to begin migration of" << tree_info.node << "to version" << i + 1 << db.lastError().text();
+            return false;
+        }
+
+        for (const QString& statement : kMigrations.at(i)(tree_info)) {
+            if (!SqlConnection::Exec(db, statement)) {
+                qWarning() << "Failed to migrate" << tree_info.node << "to version" << i + 1;
+                db.rollback();
+                return false;
+            }
+        }
+
+        if (!SetVersion(db, tree_info.node, i + 1) || !db.commit()) {
+            db.rollback();
+            return false;
+        }
+    }
+
+    if (version < kMigrations.size())
+        SqlConnection::Exec(db, "PRAGMA optimize");
+
+    return true;
+}
+
+int Schema::Version(const QSqlDatabase& db, const QString& node)
+{
+    auto query = QSqlQuery(db);
+    SqlTrace trace(query);
+
+    query.prepare("SELECT version FROM schema_version WHERE name = :name");
+    query.bindValue(":name", node);
+
+    if (!trace.Exec()) {
+        qWarning() << "Error query schema version" << query.lastError().text();
+        return 0;
+    }
+
+    return trace.Next() ? query.value(0).toInt() : 0;
+}
+
+qint64 Schema::DataVersion(const QSqlDatabase& db, const QString& node)
+{
+    auto query = QSqlQuery(db);
+    SqlTrace trace(query);
+
+    query.prepare("SELECT version FROM tree_version WHERE name = :name");
+    query.bindValue(":name", node);
+
+    if (!trace.Exec() || !trace.Next()) {
+        qWarning() << "Error query tree version" << query.lastError().text();
+        return -1;
+    }
+
+    return query.value(0).toLongLong();
+}
+
+qint64 Schema::AccountVersion(const QSqlDatabase& db, const QString& transaction, int account)
+{
+    auto query = QSqlQuery(db);
+    SqlTrace trace(query);
+
+    // Both only grow, so the sum moves whenever either does.
+    query.prepare(QString("SELECT COALESCE(SUM(version), 0) FROM %1_account_version WHERE account IN (0, :account)")
+                      .arg(transaction));
+    query.bindValue(":account", account);
+
+    if (!trace.Exec() || !trace.Next()) {
+        qWarning() << "Error query account version" << query.lastError().text();
+        return -1;
+    }
+
+    return query.value(0).toLongLong();
+}
+
+int Schema::NextId(const QSqlDatabase& db, const QString& table)
+{
+    auto query = QSqlQuery(db);
+    SqlTrace trace(query);
+
+    // sqlite_sequence keeps the largest id ever used, so the ids of deleted rows are not handed
+    // out again and rows still pointing at them cannot attach to a new one. Inserts with
+    // explicit ids advance it like any other insert.
+    query.prepare(QString("SELECT MAX(COALESCE((SELECT seq FROM sqlite_sequence WHERE name = :name), 0), "
+                          "COALESCE((SELECT MAX(id) FROM %1), 0)) + 1")
+                      .arg(table));
+    query.bindValue(":name", table);
+
+    if (!trace.Exec() || !trace.Next()) {
+        qWarning() << "Failed to read the next id of" << table << query.lastError().text();
+        return 0;
+    }
+
+    return query.value(0).toInt();
+}
+
+bool Schema::SetVersion(const QSqlDatabase& db, const QString& node, int version)
+{
+    auto query = QSqlQuery(db);
+    SqlTrace trace(query);
+
+    query.prepare("INSERT OR REPLACE INTO schema_version (name, version) VALUES (:name, :version)");
+    query.bindValue(":name", node);
+    query.bindValue(":version", version);
+
+    if (!trace.Exec()) {
+        qWarning() << "Failed to set schema version" << query.lastError().text();
+        return false;
+    }
+
+    return true;
+}
+
+bool Schema::CreateIndexes(const QSqlDatabase& db, const TreeInfo& tree_info)
+{
+    bool result = true;
+
+    for (const QString& index : Indexes(tree_info) + PostingIndexes(tree_info) + DimensionIndexes(tree_info))
+        result &= SqlConnection::Exec(db, QString("CREATE INDEX IF NOT EXISTS %1").arg(index));
+
+    return result;
+}
+
+bool Schema::DropIndexes(const QSqlDatabase& db, const TreeInfo& tree_info)
+{
+    bool result = true;
+
+    for (const QString& index : Indexes(tree_info) + PostingIndexes(tree_info) + DimensionIndexes(tree_info))
+        result &= SqlConnection::Exec(db, QString("DROP INDEX IF EXISTS %1").arg(index.section(' ', 0, 0)));
+
+    return result;
+}
+
+bool Schema::CreateTriggers(const QSqlDatabase& db, const TreeInfo& tree_info)
+{
+    bool result = true;
+
+    for (const QString& statement : VersionTriggers(tree_info) + ChangeTriggers(tree_info) + DimensionTriggers(tree_info) + BalanceTriggers(tree_info) + DateTriggers(tree_info) + AccountVersionTriggers(tree_info))
+        result &= SqlConnection::Exec(db, statement);
+
+    return result;
+}
+
+bool Schema::DropTriggers(const QSqlDatabase& db, const TreeInfo& tree_info)
+{
+    bool result = true;
+
+    // "CREATE TRIGGER IF NOT EXISTS <name> ..."
+    for (const QString& statement : VersionTriggers(tree_info) + ChangeTriggers(tree_info) + DimensionTriggers(tree_info) + BalanceTriggers(tree_info) + DateTriggers(tree_info) + AccountVersionTriggers(tree_info))
+        result &= SqlConnection::Exec(db, QString("DROP TRIGGER IF EXISTS %1").arg(statement.section(' ', 5, 5)));
+
+    return result;
+}
+
+bool Schema::Touch(const QSqlDatabase& db, const QString& node)
+{
+    // Stands in for the per-row triggers after a bulk load, observers reload the whole tree.
+    return SqlConnection::Exec(db, QString("UPDATE tree_version SET version = version + 1 WHERE name = '%1'").arg(node))
+        && SqlConnection::Exec(db, QString("INSERT INTO tree_change (name, row, operation) VALUES ('%1', 0, 'reload')").arg(node));
+}
+
+bool Schema::TouchAccounts(const QSqlDatabase& db, const QString& transaction)
+{
+    // Account 0 counts for every account, cached tables of all of them are stale.
+    return SqlConnection::Exec(db, QString("INSERT INTO %1_account_version (account, version) VALUES (0, 1) "
+                                           "ON CONFLICT (account) DO UPDATE SET version = version + 1")
+                                       .arg(transaction));
+}
+
+bool Schema::RebuildBalances(const QSqlDatabase& db, const TreeInfo& tree_info)
+{
+    bool result = true;
+
+    for (const QString& statement : BalanceStatements(tree_info))
+        result = result && SqlConnection::Exec(db, statement);
+
+    return result;
+}
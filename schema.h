@@ -0,0 +1,32 @@
+#ifndef SCHEMA_H
+#define SCHEMA_H
+
+#include "tree.h"
+#include <QSqlDatabase>
+
+// Creates and upgrades the node, node path and transaction tables of one tree.
+// The applied version is kept per node table in schema_version, every step runs
+// in its own transaction.
+
+class Schema {
+public:
+    static bool Migrate(QSqlDatabase& db, const TreeInfo& tree_info);
+    static int Version(const QSqlDatabase& db, const QString& node);
+    static qint64 DataVersion(const QSqlDatabase& db, const QString& node);
+    static qint64 AccountVersion(const QSqlDatabase& db, const QString& transaction, int account); // -1 on failure
+    static int NextId(const QSqlDatabase& db, const QString& table); // 0 on failure
+
+    static bool CreateIndexes(const QSqlDatabase& db, const TreeInfo& tree_info);
+    static bool DropIndexes(const QSqlDatabase& db, const TreeInfo& tree_info);
+
+    static bool CreateTriggers(const QSqlDatabase& db, const TreeInfo& tree_info);
+    static bool DropTriggers(const QSqlDatabase& db, const TreeInfo& tree_info);
+    static bool Touch(const QSqlDatabase& db, const QString& node);
+    static bool TouchAccounts(const QSqlDatabase& db, const QString& transaction);
+    static bool RebuildBalances(const QSqlDatabase& db, const TreeInfo& tree_info);
+
+private:
+    static bool SetVersion(const QSqlDatabase& db, const QString& node, int version);
+};
+
+#endif // SCHEMA_H
@@ -0,0 +1,46 @@
+#include "sqlconnection.h"
+#include "profiler.h"
+#include <QDebug>
+#include <QSqlError>
+#include <QSqlQuery>
+
+bool SqlConnection::ApplyProfile(const QSqlDatabase& db, const SqlProfile& profile)
+{
+    bool result = true;
+
+    result &= Exec(db, QString("PRAGMA journal_mode = %1").arg(profile.journal_mode));
+    result &= Exec(db, QString("PRAGMA synchronous = %1").arg(profile.synchronous));
+    result &= Exec(db, QString("PRAGMA mmap_size = %1").arg(profile.mmap_size));
+    result &= Exec(db, QString("PRAGMA cache_size = %1").arg(profile.cache_size));
+    result &= Exec(db, QString("PRAGMA temp_store = %1").arg(profile.temp_store));
+
+    return result;
+}
+
+bool SqlConnection::Exec(const QSqlDatabase& db, const QString& statement)
+{
+    auto query = QSqlQuery(db);
+    SqlTrace trace(query);
+
+    query.prepare(statement);
+
+    if (!trace.Exec()) {
+        qWarning() << "Failed to execute" << statement << query.lastError().text();
+        return false;
+    }
+
+    return true;
+}
+
+QSqlDatabase SqlConnection::Clone(const QString& connection, const QString& name, const SqlProfile& profile)
+{
+    auto db = QSqlDatabase::cloneDatabase(connection, name);
+
+    if (!db.open()) {
+        qWarning() << "Failed to open connection" << name << db.lastError().text();
+        return db;
+    }
+
+    ApplyProfile(db, profile);
+    return db;
+}
@@ -0,0 +1,24 @@
+#ifndef SQLCONNECTION_H
+#define SQLCONNECTION_H
+
+#include <QSqlDatabase>
+
+struct SqlProfile {
+    QString journal_mode { "WAL" };
+    QString synchronous { "NORMAL" };
+    qint64 mmap_size { 256 * 1024 * 1024 };
+    int cache_size { -64 * 1024 }; // negative values are KiB, positive values are pages
+    QString temp_store { "MEMORY" };
+};
+
+class SqlConnection {
+public:
+    static bool ApplyProfile(const QSqlDatabase& db, const SqlProfile& profile = SqlProfile());
+    static bool Exec(const QSqlDatabase& db, const QString& statement);
+
+    // Opens a copy of an existing connection for the calling thread, QSqlDatabase handles
+    // must not cross threads. Remove it with QSqlDatabase::removeDatabase(name) when done.
+    static QSqlDatabase Clone(const QString& connection, const QString& name, const SqlProfile& profile = SqlProfile());
+};
+
+#endif // SQLCONNECTION_H
@@ -0,0 +1,160 @@
+#include "sqlwriter.h"
+#include "schema.h"
+#include "statementcache.h"
+#include <QDebug>
+#include <QThread>
+#include <vector>
+
+SqlWriter::SqlWriter(const QString& connection, const SqlProfile& profile, int capacity)
+    : connection { connection }
+    , profile { profile }
+    , capacity { qMax(capacity, 1) }
+{
+    thread = QThread::create([this]() { Run(); });
+    thread->start();
+}
+
+SqlWriter::SqlWriter(const QSqlDatabase& db)
+    : connection { db.connectionName() }
+    , db { db }
+    , statements { std::make_unique<StatementCache>(db) }
+{
+}
+
+SqlWriter::~SqlWriter()
+{
+    if (!thread)
+        return;
+
+    {
+        QMutexLocker locker(&mutex);
+        stopping = true;
+        queued.wakeAll();
+        dequeued.wakeAll();
+    }
+
+    // Run() drains the queue before it returns.
+    thread->wait();
+    delete thread;
+}
+
+QFuture<QVariant> SqlWriter::Submit(Job job)
+{
+    QPromise<QVariant> promise;
+    promise.start();
+    auto future = promise.future();
+
+    if (!thread) {
+        promise.addResult(Execute(db, *statements, job));
+        promise.finish();
+        return future;
+    }
+
+    QMutexLocker locker(&mutex);
+
+    while (int(tasks.size()) >= capacity && !stopping)
+        dequeued.wait(&mutex);
+
+    tasks.push_back(Task { std::move(job), std::move(promise) });
+    ++submitted;
+    queued.wakeOne();
+
+    return future;
+}
+
+void SqlWriter::Flush()
+{
+    if (!thread)
+        return;
+
+    QMutexLocker locker(&mutex);
+    qint64 target = submitted;
+
+    while (committed < target)
+        dequeued.wait(&mutex);
+}
+
+int SqlWriter::ReserveIds(const QSqlDatabase& db, const QString& table, int count)
+{
+    QMutexLocker locker(&ids_mutex);
+
+    // Rows reserved here may not be committed yet, the database lags behind then.
+    int& next_id = next_ids[table];
+    next_id = qMax(next_id, Schema::NextId(db, table));
+    if (!next_id)
+        return 0;
+
+    int first = next_id;
+    next_id += count;
+    return first;
+}
+
+void SqlWriter::Run()
+{
+    auto name = QString("%1_writer").arg(connection);
+
+    {
+        auto writer = SqlConnection::Clone(connection, name, profile);
+        StatementCache statements(writer);
+
+        while (true) {
+            std::vector<Task> batch;
+
+            {
+                QMutexLocker locker(&mutex);
+
+                while (tasks.empty() && !stopping)
+                    queued.wait(&mutex);
+
+                if (tasks.empty())
+                    break;
+
+                while (!tasks.empty() && int(batch.size()) < kMaxBatch) {
+                    batch.push_back(std::move(tasks.front()));
+                    tasks.pop_front();
+                }
+
+                dequeued.wakeAll();
+            }
+
+            // One transaction and one commit for everything that queued up meanwhile.
+            QVector<QVariant> results(batch.size());
+            bool begun = SqlConnection::Exec(writer, "BEGIN IMMEDIATE");
+
+            for (int i = 0; begun && i != int(batch.size()); ++i)
+                results[i] = Execute(writer, statements, batch[i].job);
+
+            if (begun && !SqlConnection::Exec(writer, "COMMIT")) {
+                qWarning() << "Failed to commit" << batch.size() << "writes, rolling back";
+                SqlConnection::Exec(writer, "ROLLBACK");
+                results.fill(QVariant());
+            }
+
+            for (int i = 0; i != int(batch.size()); ++i) {
+                batch[i].promise.addResult(results.at(i));
+                batch[i].promise.finish();
+            }
+
+            QMutexLocker locker(&mutex);
+            committed += batch.size();
+            dequeued.wakeAll();
+        }
+    }
+
+    QSqlDatabase::removeDatabase(name);
+}
+
+QVariant SqlWriter::Execute(const QSqlDatabase& db, StatementCache& statements, const Job& job)
+{
+    if (!SqlConnection::Exec(db, "SAVEPOINT writer_job"))
+        return QVariant();
+
+    QVariant result = job(db, statements);
+
+    if (result.isValid() && SqlConnection::Exec(db, "RELEASE writer_job"))
+        return result;
+
+    SqlConnection::Exec(db, "ROLLBACK TO writer_job");
+    SqlConnection::Exec(db, "RELEASE writer_job");
+    return QVariant();
+}
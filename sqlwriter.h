@@ -0,0 +1,75 @@
+#ifndef SQLWRITER_H
+#define SQLWRITER_H
+
+#include "sqlconnection.h"
+#include <QFuture>
+#include <QHash>
+#include <QMutex>
+#include <QPromise>
+#include <QSqlDatabase>
+#include <QVariant>
+#include <QWaitCondition>
+#include <deque>
+#include <functional>
+#include <memory>
+
+class QThread;
+class StatementCache;
+
+// Single writer of one database. Jobs wait in a bounded queue, Submit() blocks while it is
+// full. A dedicated thread with its own connection takes everything queued, up to kMaxBatch
+// jobs, and runs it as one transaction: every job in its own savepoint, so a failing job is
+// rolled back alone, and one commit for the whole batch. A job returns an invalid QVariant
+// when it fails.
+// The inline writer runs jobs right away on the caller's connection, for in-memory
+// databases and for models that are not hosted by a registry.
+// Every model writing through one writer draws its row ids from it, so rows inserted by
+// different models before their commit never share an id.
+
+class SqlWriter {
+public:
+    using Job = std::function<QVariant(const QSqlDatabase& db, StatementCache& statements)>;
+
+    SqlWriter(const QString& connection, const SqlProfile& profile, int capacity = 1024);
+    explicit SqlWriter(const QSqlDatabase& db);
+    ~SqlWriter();
+
+    QFuture<QVariant> Submit(Job job);
+    void Flush(); // returns once everything submitted so far is committed
+    // First of count consecutive ids of table, past the committed rows and everything reserved
+    // before. 0 on failure.
+    int ReserveIds(const QSqlDatabase& db, const QString& table, int count);
+
+    static const int kMaxBatch = 256;
+
+private:
+    struct Task {
+        Job job;
+        QPromise<QVariant> promise;
+    };
+
+    void Run();
+    QVariant Execute(const QSqlDatabase& db, StatementCache& statements, const Job& job);
+
+private:
+    QString connection;
+    SqlProfile profile;
+    int capacity { 0 };
+
+    QThread* thread { nullptr };
+    QMutex mutex;
+    QWaitCondition queued;
+    QWaitCondition dequeued;
+    std::deque<Task> tasks;
+    qint64 submitted { 0 };
+    qint64 committed { 0 };
+    bool stopping { false };
+
+    QMutex ids_mutex;
+    QHash<QString, int> next_ids; // by table
+
+    QSqlDatabase db; // inline writer only
+    std::unique_ptr<StatementCache> statements;
+};
+
+#endif // SQLWRITER_H
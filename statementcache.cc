@@ -0,0 +1,36 @@
+#include "statementcache.h"
+#include <QDebug>
+#include <QSqlError>
+
+StatementCache::StatementCache(const QSqlDatabase& db)
+    : db { db }
+{
+}
+
+StatementCache::~StatementCache()
+{
+    Clear();
+}
+
+QSqlQuery& StatementCache::Prepare(const QString& statement)
+{
+    auto* query = queries.value(statement);
+
+    if (query) {
+        query->finish();
+        return *query;
+    }
+
+    query = new QSqlQuery(db);
+    if (!query->prepare(statement))
+        qWarning() << "Failed to prepare" << statement << query->lastError().text();
+
+    queries.insert(statement, query);
+    return *query;
+}
+
+void StatementCache::Clear()
+{
+    qDeleteAll(queries);
+    queries.clear();
+}
@@ -0,0 +1,24 @@
+#ifndef STATEMENTCACHE_H
+#define STATEMENTCACHE_H
+
+#include <QHash>
+#include <QSqlDatabase>
+#include <QSqlQuery>
+
+// Prepared statements of one connection keyed by their SQL text. Prepare() returns
+// a finished query ready for new bindings, every statement is compiled once.
+
+class StatementCache {
+public:
+    explicit StatementCache(const QSqlDatabase& db);
+    ~StatementCache();
+
+    QSqlQuery& Prepare(const QString& statement);
+    void Clear();
+
+private:
+    QSqlDatabase db;
+    QHash<QString, QSqlQuery*> queries;
+};
+
+#endif // STATEMENTCACHE_H
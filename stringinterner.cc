@@ -0,0 +1,92 @@
+#include "stringinterner.h"
+
+StringInterner::StringInterner()
+{
+    ids.insert(QString(), 0);
+    strings.append(QString());
+}
+
+QString StringInterner::Intern(const QString& string)
+{
+    if (string.isEmpty())
+        return string;
+
+    QMutexLocker locker(&mutex);
+    return strings.at(Insert(string));
+}
+
+int StringInterner::Id(const QString& string)
+{
+    if (string.isEmpty())
+        return 0;
+
+    QMutexLocker locker(&mutex);
+    return Insert(string);
+}
+
+QVector<int> StringInterner::Ids(const QStringList& strings)
+{
+    QVector<int> result;
+    result.reserve(strings.size());
+
+    QMutexLocker locker(&mutex);
+
+    for (const QString& string : strings)
+        result.append(string.isEmpty() ? 0 : Insert(string));
+
+    return result;
+}
+
+int StringInterner::Find(const QString& string) const
+{
+    if (string.isEmpty())
+        return 0;
+
+    QMutexLocker locker(&mutex);
+    return ids.value(string, -1);
+}
+
+QString StringInterner::String(int id) const
+{
+    QMutexLocker locker(&mutex);
+    return strings.value(id);
+}
+
+QString StringInterner::Join(const QVector<int>& ids, QChar separator) const
+{
+    QMutexLocker locker(&mutex);
+
+    qsizetype size = ids.size();
+    for (int id : ids)
+        size += strings.value(id).size();
+
+    QString string;
+    string.reserve(size);
+
+    for (int i = 0; i != ids.size(); ++i) {
+        if (i)
+            string += separator;
+        string += strings.value(ids.at(i));
+    }
+
+    return string;
+}
+
+int StringInterner::Size() const
+{
+    QMutexLocker locker(&mutex);
+    return strings.size();
+}
+
+int StringInterner::Insert(const QString& string)
+{
+    auto it = ids.constFind(string);
+    if (it != ids.constEnd())
+        return *it;
+
+    int id = strings.size();
+    ids.insert(string, id);
+    strings.append(string);
+
+    return id;
+}
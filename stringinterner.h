@@ -0,0 +1,38 @@
+#ifndef STRINGINTERNER_H
+#define STRINGINTERNER_H
+
+#include <QHash>
+#include <QMutex>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+// Thread-safe pool of implicitly shared strings, equal strings loaded by different
+// trees or threads end up pointing at one buffer. Every pooled string also gets a
+// stable integer id, 0 is the empty string, so callers can keep and compare ids
+// instead of text. Trees of a registry share its pool, a leaf path set built without one
+// owns its own.
+
+class StringInterner {
+public:
+    StringInterner();
+
+    QString Intern(const QString& string);
+    int Id(const QString& string);
+    QVector<int> Ids(const QStringList& strings); // one lock for all of them
+    int Find(const QString& string) const; // -1 when the string was never pooled
+
+    QString String(int id) const;
+    QString Join(const QVector<int>& ids, QChar separator) const;
+    int Size() const;
+
+private:
+    int Insert(const QString& string);
+
+private:
+    mutable QMutex mutex;
+    QHash<QString, int> ids;
+    QVector<QString> strings;
+};
+
+#endif // STRINGINTERNER_H
@@ -0,0 +1,394 @@
+#include "subtreestream.h"
+#include "profiler.h"
+#include <QDebug>
+#include <QFileInfo>
+#include <QIODevice>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSqlError>
+#include <QSqlQuery>
+
+namespace {
+const int kBatchSize = 50000;
+const int kFormat = 1;
+
+bool WriteLine(QIODevice* device, const QJsonObject& object)
+{
+    auto line = QJsonDocument(object).toJson(QJsonDocument::Compact);
+    line += '\n';
+
+    return device->write(line) == line.size();
+}
+
+// Empty for in-memory and temporary databases, they never match another connection.
+QString DatabasePath(const QSqlDatabase& db)
+{
+    return QFileInfo(db.databaseName()).canonicalFilePath();
+}
+
+QJsonValue Nullable(const QVariant& value)
+{
+    return value.isNull() ? QJsonValue() : QJsonValue::fromVariant(value);
+}
+}
+
+const char* SubtreeStream::kMimeType = "application/x-treemodel-subtree";
+
+SubtreeStream::SubtreeStream(const QSqlDatabase& db, const TreeInfo& tree_info, QChar separator)
+    : db { db }
+    , tree_info { tree_info }
+    , separator { separator }
+{
+}
+
+bool SubtreeStream::Write(QIODevice* device, const QList<const Node*>& nodes, bool transactions) const
+{
+    // The count lets the importer reserve ids before it hands the stream to the writer.
+    std::function<int(const Node*)> Count = [&Count](const Node* node) {
+        int count = 1;
+        for (const Node* child : node->children)
+            count += Count(child);
+
+        return count;
+    };
+
+    int count = 0;
+    for (const Node* node : nodes)
+        count += Count(node);
+
+    bool written = WriteLine(device, QJsonObject { { "format", "treemodel-subtree" }, { "version", kFormat }, { "tree", tree_info.node }, { "database", DatabasePath(db) }, { "nodes", count } });
+
+    std::function<void(const Node*, const Node*)> Visit = [device, &written, &Visit](const Node* node, const Node* parent) {
+        written = written && WriteLine(device, QJsonObject { { "n", node->id }, { "p", parent ? QJsonValue(parent->id) : QJsonValue() }, { "name", node->name }, { "description", node->description } });
+
+        for (int i = 0; written && i != node->children.size(); ++i)
+            Visit(node->children.at(i), node);
+    };
+
+    for (int i = 0; written && i != nodes.size(); ++i)
+        Visit(nodes.at(i), nullptr);
+
+    if (!written) {
+        qWarning() << "Failed to write subtree" << device->errorString();
+        return false;
+    }
+
+    if (!transactions || tree_info.transaction.isEmpty())
+        return true;
+
+    auto query = QSqlQuery(db);
+    SqlTrace trace(query);
+    query.setForwardOnly(true);
+
+    query.prepare(QString("SELECT t.id, t.source, t.target, t.note, t.description, t.debit, t.credit, t.date FROM %1 t "
+                          "INNER JOIN %2 a ON a.descendant = t.source AND a.ancestor = :root "
+                          "INNER JOIN %2 b ON b.descendant = t.target AND b.ancestor = :root")
+                      .arg(tree_info.transaction, tree_info.node_path));
+
+    for (const Node* node : nodes) {
+        query.bindValue(":root", node->id);
+
+        if (!trace.Exec()) {
+            qWarning() << "Error query transactions of subtree" << query.lastError().text();
+            return false;
+        }
+
+        while (trace.Next()) {
+            bool line_written = WriteLine(device, QJsonObject {
+                                  { "t", query.value(0).toInt() },
+                                  { "s", query.value(1).toInt() },
+                                  { "g", query.value(2).toInt() },
+                                  { "note", query.value(3).toString() },
+                                  { "description", query.value(4).toString() },
+                                  { "debit", Nullable(query.value(5)) },
+                                  { "credit", Nullable(query.value(6)) },
+                                  { "date", query.value(7).toString() },
+                              });
+
+            if (!line_written) {
+                qWarning() << "Failed to write subtree transactions" << device->errorString();
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+QList<int> SubtreeStream::LocalRoots(QIODevice* device) const
+{
+    QList<int> roots;
+
+    auto header = QJsonDocument::fromJson(device->readLine()).object();
+    auto database = DatabasePath(db);
+
+    if (header.value("format").toString() != "treemodel-subtree" || header.value("tree").toString() != tree_info.node
+        || database.isEmpty() || header.value("database").toString() != database)
+        return roots;
+
+    // The nodes come first, the first transaction ends them.
+    while (!device->atEnd()) {
+        auto object = QJsonDocument::fromJson(device->readLine().trimmed()).object();
+        if (!object.contains("n"))
+            break;
+
+        if (object.value("p").isNull())
+            roots << object.value("n").toInt();
+    }
+
+    return roots;
+}
+
+int SubtreeStream::CountNodes(QIODevice* device)
+{
+    auto header = QJsonDocument::fromJson(device->readLine()).object();
+    int count = header.value("nodes").toInt(-1);
+
+    if (header.value("format").toString() != "treemodel-subtree") {
+        count = 0;
+    } else if (count < 0) {
+        // Written before the header carried the count.
+        count = 0;
+
+        while (!device->atEnd()) {
+            auto line = device->readLine().trimmed();
+            if (line.isEmpty())
+                continue;
+
+            if (!QJsonDocument::fromJson(line).object().contains("n"))
+                break;
+
+            ++count;
+        }
+    }
+
+    device->seek(0);
+    return count;
+}
+
+QList<int> SubtreeStream::Read(QIODevice* device, int parent, int first, int count)
+{
+    QList<int> roots;
+
+    auto header = QJsonDocument::fromJson(device->readLine()).object();
+    if (header.value("format").toString() != "treemodel-subtree" || header.value("version").toInt() > kFormat) {
+        qWarning() << "Not a subtree stream";
+        return roots;
+    }
+
+    id_next = first;
+
+    if (!Stage())
+        return roots;
+
+    bool result = true;
+    bool nodes_done = false;
+
+    while (result && !device->atEnd()) {
+        auto line = device->readLine().trimmed();
+        if (line.isEmpty())
+            continue;
+
+        auto object = QJsonDocument::fromJson(line).object();
+
+        if (object.contains("n")) {
+            auto name = object.value("name").toString();
+            if (name.isEmpty() || name.contains(separator)) {
+                qWarning() << "Subtree import failed, invalid node name" << name;
+                result = false;
+                continue;
+            }
+
+            if (id_next >= first + count) {
+                qWarning() << "Subtree import failed, more nodes than reserved ids";
+                result = false;
+                continue;
+            }
+
+            int id = id_next++;
+            int exported_parent = object.value("p").toInt(-1);
+
+            ids.insert(object.value("n").toInt(), id);
+
+            node_id << id;
+            node_parent << (object.value("p").isNull() ? QVariant() : QVariant(ids.value(exported_parent)));
+            node_name << name;
+            node_description << object.value("description").toString();
+
+            if (object.value("p").isNull())
+                roots << id;
+
+            if (node_id.size() >= kBatchSize)
+                result = FlushNodes();
+
+            continue;
+        }
+
+        if (!object.contains("t") || tree_info.transaction.isEmpty())
+            continue;
+
+        if (!nodes_done) {
+            result = FlushNodes() && InsertNodes(parent);
+            nodes_done = true;
+        }
+
+        int source = ids.value(object.value("s").toInt());
+        int target = ids.value(object.value("g").toInt());
+        if (!source || !target)
+            continue;
+
+        transaction_source << source;
+        transaction_target << target;
+        transaction_note << object.value("note").toString();
+        transaction_description << object.value("description").toString();
+        transaction_debit << object.value("debit").toVariant();
+        transaction_credit << object.value("credit").toVariant();
+        transaction_date << object.value("date").toString();
+
+        if (transaction_source.size() >= kBatchSize)
+            result = FlushTransactions();
+    }
+
+    if (result && !nodes_done)
+        result = FlushNodes() && InsertNodes(parent);
+
+    result = result && FlushTransactions();
+
+    // The writer rolls the job back.
+    if (!result) {
+        qWarning() << "Subtree import failed" << db.lastError().text();
+        roots.clear();
+    }
+
+    ids.clear();
+    node_id.clear();
+    node_parent.clear();
+    node_name.clear();
+    node_description.clear();
+    transaction_source.clear();
+    transaction_target.clear();
+    transaction_note.clear();
+    transaction_description.clear();
+    transaction_debit.clear();
+    transaction_credit.clear();
+    transaction_date.clear();
+
+    return roots;
+}
+
+bool SubtreeStream::Stage()
+{
+    auto query = QSqlQuery(db);
+    SqlTrace trace(query);
+
+    // Staging rows, new_id doubles as the pre-order position because ids are handed out in stream order.
+    query.prepare("CREATE TEMP TABLE IF NOT EXISTS subtree_import ("
+                  "new_id INTEGER PRIMARY KEY, "
+                  "parent_new INTEGER, "
+                  "name TEXT NOT NULL, "
+                  "description TEXT)");
+    if (!trace.Exec())
+        return false;
+
+    query.prepare("DELETE FROM temp.subtree_import");
+    return trace.Exec();
+}
+
+bool SubtreeStream::FlushNodes()
+{
+    if (node_id.isEmpty())
+        return true;
+
+    auto query = QSqlQuery(db);
+    SqlTrace trace(query);
+
+    query.prepare("INSERT INTO temp.subtree_import (new_id, parent_new, name, description) VALUES (?, ?, ?, ?)");
+    query.addBindValue(node_id);
+    query.addBindValue(node_parent);
+    query.addBindValue(node_name);
+    query.addBindValue(node_description);
+
+    if (!trace.ExecBatch()) {
+        qWarning() << "Failed to stage subtree" << query.lastError().text();
+        return false;
+    }
+
+    node_id.clear();
+    node_parent.clear();
+    node_name.clear();
+    node_description.clear();
+
+    return true;
+}
+
+bool SubtreeStream::InsertNodes(int parent)
+{
+    auto query = QSqlQuery(db);
+    SqlTrace trace(query);
+
+    query.prepare(QString("INSERT INTO %1 (id, name, description) "
+                          "SELECT new_id, name, description FROM temp.subtree_import ORDER BY new_id")
+                      .arg(tree_info.node));
+    if (!trace.Exec()) {
+        qWarning() << "Failed to import subtree nodes" << query.lastError().text();
+        return false;
+    }
+
+    // Every staged node walks up to its subtree root, the roots' rows are then joined
+    // with the ancestors of the drop target.
+    query.prepare(QString("WITH RECURSIVE chain (ancestor, descendant, distance) AS ("
+                          "SELECT new_id, new_id, 0 FROM temp.subtree_import "
+                          "UNION ALL "
+                          "SELECT m.parent_new, c.descendant, c.distance + 1 FROM chain c "
+                          "INNER JOIN temp.subtree_import m ON m.new_id = c.ancestor WHERE m.parent_new IS NOT NULL) "
+                          "INSERT INTO %1 (ancestor, descendant, distance) "
+                          "SELECT ancestor, descendant, distance FROM chain "
+                          "UNION ALL "
+                          "SELECT a.ancestor, c.descendant, a.distance + c.distance + 1 FROM chain c "
+                          "INNER JOIN temp.subtree_import r ON r.new_id = c.ancestor AND r.parent_new IS NULL "
+                          "INNER JOIN %1 a ON a.descendant = :parent")
+                      .arg(tree_info.node_path));
+    query.bindValue(":parent", parent);
+
+    if (!trace.Exec()) {
+        qWarning() << "Failed to import subtree node_path" << query.lastError().text();
+        return false;
+    }
+
+    return true;
+}
+
+bool SubtreeStream::FlushTransactions()
+{
+    if (transaction_source.isEmpty())
+        return true;
+
+    auto query = QSqlQuery(db);
+    SqlTrace trace(query);
+
+    query.prepare(QString("INSERT INTO %1 (source, target, note, description, debit, credit, date) "
+                          "VALUES (?, ?, ?, ?, ?, ?, COALESCE(NULLIF(?, ''), '1970-01-01'))")
+                      .arg(tree_info.transaction));
+    query.addBindValue(transaction_source);
+    query.addBindValue(transaction_target);
+    query.addBindValue(transaction_note);
+    query.addBindValue(transaction_description);
+    query.addBindValue(transaction_debit);
+    query.addBindValue(transaction_credit);
+    query.addBindValue(transaction_date);
+
+    if (!trace.ExecBatch()) {
+        qWarning() << "Failed to import subtree transactions" << query.lastError().text();
+        return false;
+    }
+
+    transaction_source.clear();
+    transaction_target.clear();
+    transaction_note.clear();
+    transaction_description.clear();
+    transaction_debit.clear();
+    transaction_credit.clear();
+    transaction_date.clear();
+
+    return true;
+}
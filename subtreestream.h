@@ -0,0 +1,69 @@
+#ifndef SUBTREESTREAM_H
+#define SUBTREESTREAM_H
+
+#include "tree.h"
+#include <QHash>
+#include <QSqlDatabase>
+#include <QVariantList>
+
+class QIODevice;
+
+// Serialises subtrees as JSON lines so branches of any size stream through a file,
+// a socket or the clipboard without being held in memory twice:
+//   {"format":"treemodel-subtree","version":1,"tree":"financial","database":"/data/test.db","nodes":2}
+//   {"n":12,"p":null,"name":"Bank","description":""}     nodes in pre-order, p is null at a subtree root
+//   {"t":7,"s":12,"g":13,"note":"","description":"","debit":10,"credit":null,"date":"2024-03-05"}
+// Transactions are written when both of their accounts are inside the exported subtrees.
+// Read() runs inside the caller's transaction, a writer job: nodes receive the ids reserved
+// for them, the closure rows of all imported nodes are produced by a single recursive
+// INSERT ... SELECT.
+
+class SubtreeStream {
+public:
+    // Names holding separator are refused on import, leaf paths could not address them.
+    SubtreeStream(const QSqlDatabase& db, const TreeInfo& tree_info, QChar separator = '/');
+
+    bool Write(QIODevice* device, const QList<const Node*>& nodes, bool transactions) const;
+
+    // Returns the new ids of the imported subtree roots, attached below parent (-1 for top level).
+    // The nodes are numbered from first on, a stream holding more than count of them fails.
+    QList<int> Read(QIODevice* device, int parent, int first, int count);
+
+    // The ids of the subtree roots when the stream was written from this tree of this very
+    // database, empty otherwise. Reads the device up to the end of the nodes.
+    QList<int> LocalRoots(QIODevice* device) const;
+
+    // Number of nodes in the stream, 0 when it is none. Rewinds the device.
+    static int CountNodes(QIODevice* device);
+
+    static const char* kMimeType;
+
+private:
+    bool Stage();
+    bool FlushNodes();
+    bool InsertNodes(int parent);
+    bool FlushTransactions();
+
+private:
+    QSqlDatabase db;
+    TreeInfo tree_info;
+    QChar separator { '/' };
+
+    int id_next { 1 };
+    QHash<int, int> ids; // exported id -> new id
+
+    QVariantList node_id;
+    QVariantList node_parent;
+    QVariantList node_name;
+    QVariantList node_description;
+
+    QVariantList transaction_source;
+    QVariantList transaction_target;
+    QVariantList transaction_note;
+    QVariantList transaction_description;
+    QVariantList transaction_debit;
+    QVariantList transaction_credit;
+    QVariantList transaction_date;
+};
+
+#endif // SUBTREESTREAM_H
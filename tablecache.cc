@@ -0,0 +1,156 @@
+#include "tablecache.h"
+#include "connectionmanager.h"
+#include "profiler.h"
+#include "schema.h"
+#include "treemodel.h"
+#include <QtConcurrent>
+#include <utility>
+
+TableCache::TableCache(const QSqlDatabase& db, TreeModel* tree_model, ConnectionManager* connections, QObject* parent)
+    : QObject { parent }
+    , db { db }
+    , tree_model { tree_model }
+    , connections { connections }
+    , transaction { tree_model->GetTreeInfo().transaction }
+{
+    cache.setMaxCost(kDefaultCapacity);
+}
+
+TableCache::~TableCache()
+{
+    // The workers read through the connection manager, which may go right after us.
+    for (auto& prefetch : prefetches)
+        prefetch.waitForFinished();
+}
+
+TableModel* TableCache::Acquire(int account)
+{
+    qint64 version = Version(account);
+
+    if (auto* entry = cache.take(account)) {
+        auto* model = std::exchange(entry->model, nullptr);
+        bool stale = version < 0 || entry->version != version;
+        delete entry;
+
+        if (stale)
+            model->Reload();
+
+        checked_out.insert(account, version);
+        return model;
+    }
+
+    auto* model = Create(account, TableModel::Fetch(db, TableInfo(transaction, account)));
+    checked_out.insert(account, version);
+    return model;
+}
+
+void TableCache::Release(TableModel* model)
+{
+    if (!model)
+        return;
+
+    int account = model->GetTableInfo().id_selected;
+    qint64 version = checked_out.take(account);
+
+    model->setParent(nullptr);
+    Store(model, version);
+}
+
+void TableCache::PrefetchSiblings(const Node* node)
+{
+    // Without a connection per thread the reads would queue up behind the GUI.
+    if (!node || !node->parent || !connections->IsConcurrent())
+        return;
+
+    const auto leaf_paths = tree_model->GetLeafPaths();
+    const auto& siblings = node->parent->children;
+    int row = siblings.indexOf(node);
+
+    // Nearest first, alternating below and above the opened account.
+    QList<int> accounts;
+
+    for (int distance = 1; accounts.size() != kPrefetchSiblings && (row + distance < siblings.size() || row - distance >= 0); ++distance) {
+        for (int sibling : { row + distance, row - distance }) {
+            if (sibling < 0 || sibling >= siblings.size() || accounts.size() == kPrefetchSiblings)
+                continue;
+
+            int id = siblings.at(sibling)->id;
+
+            if (leaf_paths.Contains(id) && !cache.contains(id) && !checked_out.contains(id) && !pending.contains(id))
+                accounts << id;
+        }
+    }
+
+    prefetches.removeIf([](const QFuture<Prefetched>& prefetch) { return prefetch.isFinished(); });
+
+    for (int account : accounts) {
+        pending.insert(account);
+
+        auto prefetch = QtConcurrent::run([connections = connections, table_info = TableInfo(transaction, account)]() {
+            Prefetched prefetched;
+
+            auto db = connections->Reader();
+            if (!db.isOpen())
+                return prefetched;
+
+            // Read before the rows, a write in between makes the entry look stale rather than fresh.
+            prefetched.version = Schema::AccountVersion(db, table_info.transaction, table_info.id_selected);
+            prefetched.rows = TableModel::Fetch(db, table_info);
+            return prefetched;
+        });
+
+        prefetch.then(this, [this, account](const Prefetched& prefetched) {
+            pending.remove(account);
+
+            // Opened meanwhile, the tab read the rows itself.
+            if (prefetched.version < 0 || cache.contains(account) || checked_out.contains(account))
+                return;
+
+            Store(Create(account, prefetched.rows), prefetched.version);
+        });
+
+        prefetches << prefetch;
+    }
+}
+
+void TableCache::SetCapacity(int rows)
+{
+    cache.setMaxCost(rows);
+}
+
+int TableCache::Capacity() const
+{
+    return cache.maxCost();
+}
+
+TableModel* TableCache::Create(int account, const QList<Transaction>& rows)
+{
+    auto* model = new TableModel(db, TableInfo(transaction, account), rows, connections->Writer());
+    Profiler::Watch(model);
+
+    model->ReceiveLeafPaths(tree_model->GetLeafPaths());
+    connect(tree_model, &TreeModel::LeafPaths, model, &TableModel::ReceiveLeafPaths);
+    connect(tree_model, &TreeModel::LeafPathsChanged, model, &TableModel::PatchLeafPaths);
+
+    // A transfer shows in the tabs of both accounts, each applies what the other committed.
+    connect(model, &TableModel::TransactionsCommitted, this, [this, model](const QList<Transaction>& rows, const QList<int>& removed) {
+        emit TransactionsCommitted(model, rows, removed);
+    });
+    connect(this, &TableCache::TransactionsCommitted, model, [model](const TableModel* origin, const QList<Transaction>& rows, const QList<int>& removed) {
+        if (origin != model)
+            model->ApplyTransactions(rows, removed);
+    });
+
+    return model;
+}
+
+void TableCache::Store(TableModel* model, qint64 version)
+{
+    // The cost is the row count, an account larger than the whole cache is dropped right away.
+    cache.insert(model->GetTableInfo().id_selected, new Entry { model, version }, model->rowCount() + 1);
+}
+
+qint64 TableCache::Version(int account) const
+{
+    return Schema::AccountVersion(db, transaction, account);
+}
@@ -0,0 +1,73 @@
+#ifndef TABLECACHE_H
+#define TABLECACHE_H
+
+#include "tablemodel.h"
+#include <QCache>
+#include <QFuture>
+#include <QHash>
+#include <QObject>
+#include <QSet>
+
+class ConnectionManager;
+class TreeModel;
+struct Node;
+
+// Table models of the leaf accounts of one tree. A model is checked out while a tab shows
+// it and returned when the tab closes. Returned models wait in an LRU cache bounded by rows,
+// not bytes: a model costs its row count, so the least recently closed accounts go first
+// once the cache holds capacity rows. Opening an account reads the transactions of its
+// nearest sibling leaves on worker threads into the same cache. A cached model is reloaded
+// on reuse when a transaction posted from or to its account changed since it was read,
+// edits of other accounts leave it alone. Every model follows the leaf paths of the tree
+// model, and the edits the other models commit on transactions it shows.
+
+class TableCache : public QObject {
+    Q_OBJECT
+
+public:
+    TableCache(const QSqlDatabase& db, TreeModel* tree_model, ConnectionManager* connections, QObject* parent = nullptr);
+    ~TableCache();
+
+    TableModel* Acquire(int account); // owned by the caller until Release
+    void Release(TableModel* model);
+    void PrefetchSiblings(const Node* node);
+
+    void SetCapacity(int rows);
+    int Capacity() const;
+
+    static const int kDefaultCapacity = 200000;
+    static const int kPrefetchSiblings = 8;
+
+signals:
+    void TransactionsCommitted(const TableModel* origin, const QList<Transaction>& rows, const QList<int>& removed);
+
+private:
+    struct Entry {
+        TableModel* model { nullptr };
+        qint64 version { -1 };
+
+        ~Entry() { delete model; }
+    };
+
+    struct Prefetched {
+        QList<Transaction> rows;
+        qint64 version { -1 };
+    };
+
+    TableModel* Create(int account, const QList<Transaction>& rows);
+    void Store(TableModel* model, qint64 version);
+    qint64 Version(int account) const;
+
+private:
+    QSqlDatabase db;
+    TreeModel* tree_model { nullptr };
+    ConnectionManager* connections { nullptr };
+    QString transaction;
+
+    QCache<int, Entry> cache;
+    QHash<int, qint64> checked_out; // by account, account version the rows were read at
+    QSet<int> pending;
+    QList<QFuture<Prefetched>> prefetches;
+};
+
+#endif // TABLECACHE_H
@@ -1,26 +1,69 @@
 #include "tablemodel.h"
+#include "profiler.h"
+#include "sqlwriter.h"
+#include <QDebug>
+#include <QHash>
+#include <QSet>
 #include <QSqlError>
 #include <QSqlQuery>
 
-TableModel::TableModel(const QSqlDatabase& db, const TableInfo& table_info, QObject* parent)
+namespace {
+// Eight values a row, a full chunk stays below SQLite's default limit of 999 parameters.
+const int kInsertChunk = 100;
+const int kDeleteChunk = 400;
+
+QVariant SqlValue(const QVariant& value)
+{
+    if (value.typeId() == QMetaType::QDate)
+        return value.toDate().toString(Qt::ISODate);
+
+    return value;
+}
+
+QVariant Money(double amount)
+{
+    return amount != 0.0 ? QVariant(amount) : QVariant();
+}
+
+// Both posting indexes serve it, as a multi-index OR.
+QString SelectRows(const QString& table)
+{
+    return QString("SELECT id, source, target, note, description, debit, credit, date FROM %1 "
+                   "WHERE source = :id OR target = :id ORDER BY date, id")
+        .arg(table);
+}
+}
+
+TableModel::TableModel(const QSqlDatabase& db, const TableInfo& table_info, SqlWriter* writer, QObject* parent)
+    : TableModel(db, table_info, Fetch(db, table_info), writer, parent)
+{
+}
+
+TableModel::TableModel(const QSqlDatabase& db, const TableInfo& table_info, const QList<Transaction>& rows,
+    SqlWriter* writer, QObject* parent)
     : QAbstractTableModel { parent }
     , table_info { table_info }
     , db { db }
+    , statements { db }
+    , columns { table_info.columns }
+    , writer { writer }
 {
+    if (!writer) {
+        own_writer = std::make_unique<SqlWriter>(db);
+        this->writer = own_writer.get();
+    }
 
-    headers << "ID"
-            << "Source"
-            << "Note"
-            << "Description"
-            << "Target"
-            << "Debit"
-            << "Credit";
+    connect(this, &QAbstractItemModel::dataChanged, this, &TableModel::InvalidateFormat);
+    connect(this, &QAbstractItemModel::modelReset, this, [this]() { format_cache.Clear(); });
+    connect(this, &QAbstractItemModel::layoutChanged, this, [this]() { format_cache.Clear(); });
+    connect(this, &QAbstractItemModel::rowsRemoved, this, [this]() { format_cache.Clear(); });
 
-    ConstructTable(db, table_info.id_selected);
+    Adopt(rows);
 }
 
 TableModel::~TableModel()
 {
+    qDeleteAll(transactions);
 }
 
 int TableModel::rowCount(const QModelIndex& parent) const
@@ -32,30 +75,109 @@ int TableModel::rowCount(const QModelIndex& parent) const
 int TableModel::columnCount(const QModelIndex& parent) const
 {
     Q_UNUSED(parent);
-    return headers.size();
+    return columns.size;
 }
 
 QVariant TableModel::data(const QModelIndex& index, int role) const
 {
+    Profiler::Count(Counter::kData);
+
     if (!index.isValid())
         return QVariant();
 
-    int row = index.row();
-
-    if (role == Qt::DisplayRole) {
-        switch (index.column()) {
-        case 0:
-            return transactions.at(row)->id;
-        case 1:
-            return transactions.at(row)->note;
-        case 2:
-            return transactions.at(row)->description;
-        default:
-            return QVariant();
+    auto* transaction = transactions.at(index.row());
+
+    if (role == Qt::EditRole)
+        return columns[index.column()].get(*transaction);
+
+    return format_cache.Value(transaction, index.column(), role, [this](const Transaction& transaction) { return FormatRow(transaction); });
+}
+
+QVector<QVariant> TableModel::FormatRow(const Transaction& transaction) const
+{
+    QVector<QVariant> values(columns.size * kFormatRoleCount);
+
+    auto Path = [this](int id) { return leaf_paths.Contains(id) ? leaf_paths.Path(id) : QString::number(id); };
+    QString tooltip = QString("%1 -> %2").arg(Path(transaction.source), Path(transaction.target));
+
+    for (int column = 0; column != columns.size; ++column) {
+        values[column * kFormatRoleCount] = columns[column].display(transaction);
+        values[column * kFormatRoleCount + 1] = int(columns[column].alignment);
+        values[column * kFormatRoleCount + 2] = tooltip;
+    }
+
+    return values;
+}
+
+void TableModel::InvalidateFormat(const QModelIndex& top_left, const QModelIndex& bottom_right)
+{
+    for (int row = top_left.row(); row <= bottom_right.row(); ++row)
+        format_cache.Remove(transactions.value(row));
+}
+
+void TableModel::ReceiveLeafPaths(const LeafPathSet& paths)
+{
+    leaf_paths = paths;
+    format_cache.Clear();
+}
+
+void TableModel::ApplyTransactions(const QList<Transaction>& rows, const QList<int>& removed)
+{
+    QSet<int> gone(removed.cbegin(), removed.cend());
+    QHash<int, const Transaction*> posted;
+
+    for (const auto& row : rows) {
+        if (IsPosted(row))
+            posted.insert(row.id, &row);
+        else
+            gone.insert(row.id);
+    }
+
+    double amount = 0.0;
+
+    // Back to front, the rows above keep their place.
+    for (int row = transactions.size() - 1; row >= 0; --row) {
+        auto* transaction = transactions.at(row);
+
+        if (gone.contains(transaction->id)) {
+            beginRemoveRows(QModelIndex(), row, row);
+            amount -= Amount(*transaction);
+            delete transactions.takeAt(row);
+            endRemoveRows();
+            continue;
+        }
+
+        if (const auto* changed = posted.take(transaction->id)) {
+            amount += Amount(*changed) - Amount(*transaction);
+            *transaction = *changed;
+            emit dataChanged(index(row, 0), index(row, columns.size - 1));
         }
     }
 
-    return QVariant();
+    // What is left was posted to the account by the edit, it joins at the end.
+    for (const auto& row : rows) {
+        if (!posted.contains(row.id))
+            continue;
+
+        beginInsertRows(QModelIndex(), transactions.size(), transactions.size());
+        transactions.append(new Transaction(row));
+        amount += Amount(row);
+        endInsertRows();
+    }
+
+    AdjustBalance(amount);
+}
+
+void TableModel::PatchLeafPaths(const LeafPathSet& paths, const QList<int>& ids)
+{
+    leaf_paths = paths;
+
+    // Only rows booked against a changed account carry a stale tooltip.
+    QSet<int> changed(ids.cbegin(), ids.cend());
+    for (const auto* transaction : qAsConst(transactions)) {
+        if (changed.contains(transaction->source) || changed.contains(transaction->target))
+            format_cache.Remove(transaction);
+    }
 }
 
 bool TableModel::setData(const QModelIndex& index, const QVariant& value, int role)
@@ -63,53 +185,44 @@ bool TableModel::setData(const QModelIndex& index, const QVariant& value, int ro
     if (!index.isValid() || role != Qt::EditRole)
         return false;
 
-    int row = index.row();
+    const auto& column = columns[index.column()];
+    auto* transaction = transactions[index.row()];
 
-    switch (index.column()) {
-    case 0:
-        transactions[row]->id = value.toInt();
-        return true;
-    case 1:
-        transactions[row]->note = value.toString();
-        return true;
-    case 2:
-        transactions[row]->description = value.toString();
+    // The account editor hands over a leaf path.
+    auto stored = IsAccount(index.column()) ? Account(value) : value;
+    double amount = Amount(*transaction);
+
+    if (!stored.isValid() || !column.set || !column.set(*transaction, stored))
+        return false;
+
+    emit dataChanged(index, index, QVector<int>() << role);
+    AdjustBalance(Amount(*transaction) - amount);
+
+    if (!column.sql)
         return true;
-    }
 
-    return false;
+    auto written = UpdateRecord(transaction->id, column.sql, SqlValue(column.get(*transaction)));
+    return !Reconcile(written, { *transaction }).isCanceled();
 }
 
 QVariant TableModel::headerData(int section, Qt::Orientation orientation, int role) const
 {
-    if (orientation == Qt::Horizontal && role == Qt::DisplayRole)
-        return headers.at(section);
+    if (orientation == Qt::Horizontal && role == Qt::DisplayRole && columns.Contains(section))
+        return columns[section].header;
 
     return QVariant();
 }
 
 void TableModel::sort(int column, Qt::SortOrder order)
 {
-    emit layoutAboutToBeChanged();
+    if (!columns.Contains(column))
+        return;
 
-    auto Compare = [column, order](const Transaction* lhs, const Transaction* rhs) -> bool {
-        bool result;
-        switch (column) {
-        case 0:
-            result = lhs->id < rhs->id;
-            break;
-        case 1:
-            result = lhs->note < rhs->note;
-            break;
-        case 2:
-            result = lhs->description < rhs->description;
-            break;
-        default:
-            result = false;
-            break;
-        }
+    emit layoutAboutToBeChanged();
 
-        return order == Qt::AscendingOrder ? result : !result;
+    auto Less = columns[column].less;
+    auto Compare = [Less, order](const Transaction* lhs, const Transaction* rhs) -> bool {
+        return order == Qt::AscendingOrder ? Less(*lhs, *rhs) : Less(*rhs, *lhs);
     };
 
     std::sort(transactions.begin(), transactions.end(), Compare);
@@ -119,23 +232,26 @@ void TableModel::sort(int column, Qt::SortOrder order)
 
 bool TableModel::insertRows(int row, int count, const QModelIndex& parent)
 {
-    if (row < 0 || count != 1 || !parent.isValid())
+    if (count < 1 || parent.isValid())
         return false;
 
-    //    auto transaction = new Transaction(0, "", "");
-    //    transactions.insert(row, transaction);
+    QList<Transaction> rows;
+    rows.reserve(count);
+
+    for (int i = 0; i != count; ++i) {
+        rows << Transaction(0, table_info.id_selected, table_info.id_selected);
+        rows.last().date = QDate::currentDate();
+    }
 
-    return true;
+    return !InsertTransactions(row, rows).isCanceled();
 }
 
 bool TableModel::removeRows(int row, int count, const QModelIndex& parent)
 {
-    if (row < 0 || count != 1 || !parent.isValid())
+    if (parent.isValid())
         return false;
 
-    transactions.remove(row, 1);
-
-    return true;
+    return !RemoveTransactions(row, count).isCanceled();
 }
 
 Qt::ItemFlags TableModel::flags(const QModelIndex& index) const
@@ -143,60 +259,341 @@ Qt::ItemFlags TableModel::flags(const QModelIndex& index) const
     if (!index.isValid())
         return Qt::NoItemFlags;
 
-    auto default_flags = QAbstractItemModel::flags(index);
+    return columns[index.column()].flags | QAbstractItemModel::flags(index);
+}
+
+const TableInfo& TableModel::GetTableInfo() const
+{
+    return table_info;
+}
+
+double TableModel::Balance() const
+{
+    return balance;
+}
+
+void TableModel::Reload()
+{
+    beginResetModel();
+
+    qDeleteAll(transactions);
+    transactions.clear();
+    ConstructTable();
+
+    endResetModel();
+}
+
+QFuture<int> TableModel::InsertTransactions(int row, const QList<Transaction>& rows)
+{
+    if (row < 0 || row > transactions.size() || rows.isEmpty())
+        return QFuture<int>();
+
+    // Ids are handed out here, so the rows shown before their commit keep them.
+    int first = ReserveIds(rows.size());
+    if (!first)
+        return QFuture<int>();
+
+    QList<Transaction> records;
+    records.reserve(rows.size());
+    double amount = 0.0;
 
-    switch (index.column()) {
-    case 0:
-        return default_flags;
-    default:
-        return Qt::ItemIsEditable | default_flags;
+    beginInsertRows(QModelIndex(), row, row + rows.size() - 1);
+
+    for (int i = 0; i != rows.size(); ++i) {
+        auto* transaction = new Transaction(rows.at(i));
+        transaction->id = first + i;
+
+        transactions.insert(row + i, transaction);
+        records << *transaction;
+        amount += Amount(*transaction);
+    }
+
+    endInsertRows();
+    AdjustBalance(amount);
+
+    auto written = InsertRecords(records);
+    return Reconcile(written, records).then([first](bool committed) { return committed ? first : 0; });
+}
+
+QFuture<bool> TableModel::RemoveTransactions(int row, int count)
+{
+    if (row < 0 || count < 1 || row + count > transactions.size())
+        return QFuture<bool>();
+
+    QList<int> ids;
+    ids.reserve(count);
+    double amount = 0.0;
+
+    beginRemoveRows(QModelIndex(), row, row + count - 1);
+
+    for (int i = 0; i != count; ++i) {
+        auto* transaction = transactions.takeAt(row);
+        ids << transaction->id;
+        amount -= Amount(*transaction);
+        delete transaction;
+    }
+
+    endRemoveRows();
+    AdjustBalance(amount);
+
+    return Reconcile(DeleteRecords(ids), QList<Transaction>(), ids);
+}
+
+QFuture<int> TableModel::Paste(int row, const QString& text)
+{
+    QList<Transaction> rows;
+    int skipped = 0;
+
+    for (QString line : text.split('\n', Qt::SkipEmptyParts)) {
+        if (line.endsWith('\r'))
+            line.chop(1);
+
+        const auto fields = line.split('\t');
+        Transaction transaction(0, table_info.id_selected, table_info.id_selected);
+        transaction.date = QDate::currentDate();
+
+        bool valid = true;
+        int field = 0;
+
+        for (int column = 0; valid && column != columns.size && field != fields.size(); ++column) {
+            if (!columns[column].set)
+                continue;
+
+            QVariant value = fields.at(field++).trimmed();
+
+            // Empty cells keep the defaults: this account, today, nothing posted.
+            if (value.toString().isEmpty())
+                continue;
+
+            if (IsAccount(column))
+                value = Account(value);
+
+            valid = value.isValid() && columns[column].set(transaction, value);
+        }
+
+        if (valid && transaction.date.isValid())
+            rows << transaction;
+        else
+            ++skipped;
     }
+
+    if (skipped)
+        qWarning() << "Skipped" << skipped << "pasted lines with unknown accounts or invalid values";
+
+    return InsertTransactions(row, rows);
 }
 
-void TableModel::ConstructTable(const QSqlDatabase& db, int id_selected)
+QList<Transaction> TableModel::Fetch(const QSqlDatabase& db, const TableInfo& table_info)
 {
     auto query = QSqlQuery(db);
+    query.prepare(SelectRows(table_info.transaction));
+
+    return Read(query, table_info);
+}
+
+QList<Transaction> TableModel::Read(QSqlQuery& query, const TableInfo& table_info)
+{
+    QList<Transaction> rows;
+    SqlTrace trace(query);
 
-    query.prepare(QString("SELECT :id_selected, note, description FROM %1").arg(table_info.transaction));
-    query.bindValue(":id_selected", id_selected);
+    query.bindValue(":id", table_info.id_selected);
 
-    if (!query.exec()) {
+    if (!trace.Exec()) {
         qWarning() << QString("Error query data from %1").arg(table_info.transaction)
                    << query.lastError().text();
+        return rows;
+    }
+
+    while (trace.Next()) {
+        Transaction transaction(query.value(0).toInt(), query.value(1).toInt(), query.value(2).toInt());
+        transaction.note = query.value(3).toString();
+        transaction.description = query.value(4).toString();
+        transaction.debit = query.value(5).toDouble();
+        transaction.credit = query.value(6).toDouble();
+        transaction.date = QDate::fromString(query.value(7).toString(), Qt::ISODate);
+
+        rows << transaction;
     }
 
-    int id = 0;
-    QString note;
-    QString description;
+    query.finish();
+    return rows;
+}
+
+void TableModel::ConstructTable()
+{
+    Adopt(Read(statements.Prepare(SelectRows(table_info.transaction)), table_info));
+}
 
-    while (query.next()) {
-        id = query.value(0).toInt();
-        note = query.value(1).toString();
-        description = query.value(2).toString();
+void TableModel::Adopt(const QList<Transaction>& rows)
+{
+    balance = 0.0;
+    transactions.reserve(rows.size());
 
-        //        auto* transaction = new Transaction(id, note, description);
-        //        transactions.emplace_back(transaction);
+    for (const auto& row : rows) {
+        transactions.emplace_back(new Transaction(row));
+        balance += Amount(row);
     }
+
+    emit BalanceChanged(balance);
 }
 
-bool TableModel::InsertRecord()
+QFuture<QVariant> TableModel::InsertRecords(const QList<Transaction>& rows)
 {
-    auto query = QSqlQuery(db);
+    return writer->Submit([table = table_info.transaction, rows](const QSqlDatabase& db, StatementCache& statements) {
+        // Multi-row statements, hundreds of pasted rows take a few round trips instead of one each.
+        for (int from = 0; from < rows.size(); from += kInsertChunk) {
+            int count = qMin(kInsertChunk, int(rows.size()) - from);
+            auto sql = QString("INSERT INTO %1 (id, source, target, note, description, debit, credit, date) VALUES %2")
+                           .arg(table, QStringList(count, "(?, ?, ?, ?, ?, ?, ?, ?)").join(", "));
+
+            // Only full chunks are worth caching, the odd sized tail runs once.
+            QSqlQuery tail(db);
+            if (count != kInsertChunk)
+                tail.prepare(sql);
+
+            auto& query = count == kInsertChunk ? statements.Prepare(sql) : tail;
+            SqlTrace trace(query);
+
+            for (int i = 0; i != count; ++i) {
+                const auto& row = rows.at(from + i);
+                int first = 8 * i;
+
+                query.bindValue(first, row.id);
+                query.bindValue(first + 1, row.source);
+                query.bindValue(first + 2, row.target);
+                query.bindValue(first + 3, row.note);
+                query.bindValue(first + 4, row.description);
+                query.bindValue(first + 5, Money(row.debit));
+                query.bindValue(first + 6, Money(row.credit));
+                query.bindValue(first + 7, row.date.toString(Qt::ISODate));
+            }
+
+            if (!trace.Exec()) {
+                qWarning() << "Failed to add transactions" << query.lastError().text();
+                return QVariant();
+            }
+        }
+
+        return QVariant(int(rows.size()));
+    });
+}
+
+QFuture<QVariant> TableModel::UpdateRecord(int id, const QString& column, const QVariant& value)
+{
+    return writer->Submit([table = table_info.transaction, id, column, value](const QSqlDatabase& db, StatementCache& statements) {
+        Q_UNUSED(db);
+
+        auto& query = statements.Prepare(QString("UPDATE %1 SET %2 = :value WHERE id = :id").arg(table, column));
+        SqlTrace trace(query);
+
+        query.bindValue(":value", value);
+        query.bindValue(":id", id);
+
+        if (!trace.Exec()) {
+            qWarning() << "Failed to update transaction" << query.lastError().text();
+            return QVariant();
+        }
+
+        return QVariant(true);
+    });
+}
+
+QFuture<QVariant> TableModel::DeleteRecords(const QList<int>& ids)
+{
+    return writer->Submit([table = table_info.transaction, ids](const QSqlDatabase& db, StatementCache& statements) {
+        for (int from = 0; from < ids.size(); from += kDeleteChunk) {
+            int count = qMin(kDeleteChunk, int(ids.size()) - from);
+            auto placeholders = QStringList(count, "?").join(", ");
+
+            // Dimension mappings first, they reference the transaction.
+            QStringList deletes;
+            deletes << QString("DELETE FROM %1_dimension WHERE transaction_id IN (%2)").arg(table, placeholders)
+                    << QString("DELETE FROM %1 WHERE id IN (%2)").arg(table, placeholders);
+
+            for (const QString& sql : deletes) {
+                QSqlQuery tail(db);
+                if (count != kDeleteChunk)
+                    tail.prepare(sql);
+
+                auto& query = count == kDeleteChunk ? statements.Prepare(sql) : tail;
+                SqlTrace trace(query);
+
+                for (int i = 0; i != count; ++i)
+                    query.bindValue(i, ids.at(from + i));
+
+                if (!trace.Exec()) {
+                    qWarning() << "Failed to remove transactions" << query.lastError().text();
+                    return QVariant();
+                }
+            }
+        }
+
+        return QVariant(true);
+    });
+}
 
-    query.prepare(QString("INSERT INTO %1 DEFAULT VALUES ").arg(table_info.transaction));
+QFuture<bool> TableModel::Reconcile(QFuture<QVariant> written, const QList<Transaction>& rows, const QList<int>& removed)
+{
+    return written.then(this, [this, rows, removed](const QVariant& result) {
+        if (result.isValid()) {
+            emit TransactionsCommitted(rows, removed);
+            return true;
+        }
 
-    if (!query.exec()) {
-        qWarning() << "Failed to add node" << query.lastError().text();
+        // The rows show an edit the database refused, start over from what is committed.
+        qWarning() << "A write to" << table_info.transaction << "failed, reloading";
+        Reload();
         return false;
-    }
+    });
+}
+
+int TableModel::ReserveIds(int count)
+{
+    // Drawn from the writer, models of other accounts insert into the same table.
+    return writer->ReserveIds(db, table_info.transaction, count);
+}
+
+bool TableModel::IsPosted(const Transaction& transaction) const
+{
+    return transaction.source == table_info.id_selected || transaction.target == table_info.id_selected;
+}
 
-    id_last_insert = query.lastInsertId().toInt();
+bool TableModel::IsAccount(int column) const
+{
+    const char* sql = columns[column].sql;
+    return sql && (qstrcmp(sql, "source") == 0 || qstrcmp(sql, "target") == 0);
+}
+
+QVariant TableModel::Account(const QVariant& value) const
+{
+    bool ok = false;
+    int id = value.toInt(&ok);
+
+    if (!ok)
+        id = leaf_paths.Find(value.toString().trimmed());
+
+    // Postings go to leaves only.
+    return leaf_paths.Contains(id) ? QVariant(id) : QVariant();
 }
 
-bool TableModel::UpdateRecord(int id, QString column, QString string)
+double TableModel::Amount(const Transaction& transaction) const
 {
+    double amount = 0.0;
+
+    if (transaction.source == table_info.id_selected)
+        amount += transaction.debit - transaction.credit;
+
+    if (transaction.target == table_info.id_selected)
+        amount += transaction.credit - transaction.debit;
+
+    return amount;
 }
 
-bool TableModel::DeleteRecord(int id)
+void TableModel::AdjustBalance(double delta)
 {
+    if (delta == 0.0)
+        return;
+
+    balance += delta;
+    emit BalanceChanged(balance);
 }
@@ -1,8 +1,18 @@
 #ifndef TABLEMODEL_H
 #define TABLEMODEL_H
 
+#include "column.h"
+#include "formatcache.h"
+#include "leafpathset.h"
+#include "statementcache.h"
 #include <QAbstractTableModel>
+#include <QDate>
+#include <QFuture>
 #include <QSqlDatabase>
+#include <memory>
+
+class QSqlQuery;
+class SqlWriter;
 
 struct Transaction {
     int id { 0 };
@@ -12,6 +22,7 @@ struct Transaction {
     int target { 0 };
     double debit { 0.00 };
     double credit { 0.00 };
+    QDate date {};
 
     Transaction(int id, int source, int target)
         : id { id }
@@ -21,22 +32,45 @@ struct Transaction {
     }
 };
 
+inline constexpr std::array<Column<Transaction>, 8> kTransactionColumns {
+    MakeColumn<&Transaction::id>("ID", "id", false),
+    MakeColumn<&Transaction::source>("Source", "source", true),
+    MakeColumn<&Transaction::note>("Note", "note", true),
+    MakeColumn<&Transaction::description>("Description", "description", true),
+    MakeColumn<&Transaction::target>("Target", "target", true),
+    MakeColumn<&Transaction::debit>("Debit", "debit", true),
+    MakeColumn<&Transaction::credit>("Credit", "credit", true),
+    MakeColumn<&Transaction::date>("Date", "date", true),
+};
+
 struct TableInfo {
     QString transaction { "" };
     int id_selected { 0 };
+    ColumnSet<Transaction> columns { kTransactionColumns };
 
-    TableInfo(QString transaction, int id)
+    TableInfo(QString transaction, int id, ColumnSet<Transaction> columns = kTransactionColumns)
         : transaction { transaction }
         , id_selected { id }
+        , columns { columns }
     {
     }
 };
 
+// Transactions posted from or to one account. Rows are read through the model's connection
+// and cached statements, edits are applied in memory right away and queued on the writer,
+// one job per edit however many rows it touches. A write that fails is reconciled by
+// reloading the rows. The account's balance follows every edit by the difference it makes.
+// Committed edits are announced so models of the other accounts of a transaction follow.
+
 class TableModel : public QAbstractTableModel {
     Q_OBJECT
 
 public:
-    explicit TableModel(const QSqlDatabase& db, const TableInfo& table_info, QObject* parent = nullptr);
+    // Without a writer edits run inline on db.
+    TableModel(const QSqlDatabase& db, const TableInfo& table_info, SqlWriter* writer = nullptr, QObject* parent = nullptr);
+    // Rows read elsewhere, by Fetch() on a worker for instance.
+    TableModel(const QSqlDatabase& db, const TableInfo& table_info, const QList<Transaction>& rows,
+        SqlWriter* writer, QObject* parent = nullptr);
     ~TableModel();
 
 public:
@@ -60,19 +94,66 @@ public:
 
     Qt::ItemFlags flags(const QModelIndex& index) const override;
 
+public:
+    const TableInfo& GetTableInfo() const;
+    double Balance() const; // debit - credit posted from the account plus credit - debit posted into it
+    void Reload();
+
+    // The futures report whether the write committed. An edit rejected up front returns a
+    // canceled future and changes nothing.
+    QFuture<int> InsertTransactions(int row, const QList<Transaction>& rows); // first id
+    QFuture<bool> RemoveTransactions(int row, int count);
+    // Lines copied from a spreadsheet, the editable columns in table order separated by tabs.
+    // Accounts are given by id or leaf path, every line becomes one row of a single write.
+    QFuture<int> Paste(int row, const QString& text);
+
+    // Rows of table_info's account, safe on any thread with a connection of its own.
+    static QList<Transaction> Fetch(const QSqlDatabase& db, const TableInfo& table_info);
+
+signals:
+    void BalanceChanged(double balance);
+    // Rows as written, inserted or changed, and the ids of removed rows.
+    void TransactionsCommitted(const QList<Transaction>& rows, const QList<int>& removed);
+
+public slots:
+    void ReceiveLeafPaths(const LeafPathSet& paths);
+    void PatchLeafPaths(const LeafPathSet& paths, const QList<int>& ids);
+    // Edits committed by another model, rows no longer posted to or from the account leave.
+    void ApplyTransactions(const QList<Transaction>& rows, const QList<int>& removed);
+
 private:
-    void ConstructTable(const QSqlDatabase& db, int id);
-    bool InsertRecord();
-    bool UpdateRecord(int id, QString column, QString string);
-    bool DeleteRecord(int id);
+    void ConstructTable();
+    void Adopt(const QList<Transaction>& rows);
+    static QList<Transaction> Read(QSqlQuery& query, const TableInfo& table_info);
+    QFuture<QVariant> InsertRecords(const QList<Transaction>& rows);
+    QFuture<QVariant> UpdateRecord(int id, const QString& column, const QVariant& value);
+    QFuture<QVariant> DeleteRecords(const QList<int>& ids);
+    QFuture<bool> Reconcile(QFuture<QVariant> written, const QList<Transaction>& rows, const QList<int>& removed = QList<int>());
+    int ReserveIds(int count);
+    bool IsPosted(const Transaction& transaction) const;
+
+    bool IsAccount(int column) const;
+    QVariant Account(const QVariant& value) const; // leaf id of an id or path, invalid when unknown
+    double Amount(const Transaction& transaction) const;
+    void AdjustBalance(double delta);
+
+    QVector<QVariant> FormatRow(const Transaction& transaction) const;
+    void InvalidateFormat(const QModelIndex& top_left, const QModelIndex& bottom_right);
 
 private:
     QList<Transaction*> transactions;
     QSqlDatabase db;
     TableInfo table_info;
+    StatementCache statements;
+
+    ColumnSet<Transaction> columns;
+    FormatCache<Transaction> format_cache;
+
+    LeafPathSet leaf_paths;
 
-    int id_last_insert;
-    QStringList headers;
+    SqlWriter* writer { nullptr };
+    std::unique_ptr<SqlWriter> own_writer;
+    double balance { 0.0 };
 };
 
 #endif // TABLEMODEL_H
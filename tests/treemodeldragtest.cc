@@ -0,0 +1,143 @@
+#include "closurestore.h"
+#include "schema.h"
+#include "treemodel.h"
+
+#include <QMimeData>
+#include <QSqlDatabase>
+#include <QTest>
+#include <QTreeView>
+#include <memory>
+
+// Drops onto a real QTreeView, then does what QAbstractItemView::startDrag does once QDrag::exec
+// returns: a drag that ended in a move removes the selected rows of the dragging view. QDrag::exec
+// itself runs a platform drag loop and cannot be driven from a test.
+
+class TreeModelDragTest : public QObject {
+    Q_OBJECT
+
+private slots:
+    void init();
+    void cleanup();
+
+    void InternalMoveKeepsNode();
+    void InternalCopyAddsNode();
+
+private:
+    QModelIndex Find(const TreeModel& model, const QString& name, const QModelIndex& parent = QModelIndex()) const;
+    Qt::DropAction Drop(QTreeView& view, const QModelIndex& source, const QModelIndex& target, Qt::DropAction action);
+
+private:
+    QSqlDatabase db;
+    TreeInfo tree_info { "financial", "financial_path" };
+
+    int first { 0 };
+    int second { 0 };
+    int leaf { 0 };
+};
+
+void TreeModelDragTest::init()
+{
+    db = QSqlDatabase::addDatabase("QSQLITE", "drag_test");
+    db.setDatabaseName(":memory:");
+
+    QVERIFY(db.open());
+    QVERIFY(Schema::Migrate(db, tree_info));
+
+    ClosureStore store(db, tree_info);
+    first = store.Insert(-1, "First");
+    second = store.Insert(-1, "Second");
+    leaf = store.Insert(first, "Leaf");
+
+    QVERIFY(first && second && leaf);
+}
+
+void TreeModelDragTest::cleanup()
+{
+    db.close();
+    db = QSqlDatabase();
+    QSqlDatabase::removeDatabase("drag_test");
+}
+
+void TreeModelDragTest::InternalMoveKeepsNode()
+{
+    TreeModel model(db, tree_info);
+    QTreeView view;
+    view.setModel(&model);
+
+    // The drop moves the row itself and must not end the drag as a move.
+    QCOMPARE(Drop(view, Find(model, "Leaf", Find(model, "First")), Find(model, "Second"), Qt::MoveAction), Qt::IgnoreAction);
+
+    QModelIndex moved = Find(model, "Leaf", Find(model, "Second"));
+    QVERIFY(moved.isValid());
+    QVERIFY(!Find(model, "Leaf", Find(model, "First")).isValid());
+
+    QCoreApplication::processEvents();
+    QCOMPARE(ClosureStore(db, tree_info).FetchParent(leaf), second);
+}
+
+void TreeModelDragTest::InternalCopyAddsNode()
+{
+    TreeModel model(db, tree_info);
+    QTreeView view;
+    view.setModel(&model);
+
+    QCOMPARE(Drop(view, Find(model, "Leaf", Find(model, "First")), Find(model, "Second"), Qt::CopyAction), Qt::CopyAction);
+
+    // The copy is attached once the write is in.
+    QTRY_VERIFY(Find(model, "Leaf", Find(model, "Second")).isValid());
+    QVERIFY(Find(model, "Leaf", Find(model, "First")).isValid());
+    QCOMPARE(ClosureStore(db, tree_info).FetchParent(leaf), first);
+}
+
+QModelIndex TreeModelDragTest::Find(const TreeModel& model, const QString& name, const QModelIndex& parent) const
+{
+    for (int row = 0; row != model.rowCount(parent); ++row) {
+        auto index = model.index(row, 0, parent);
+        if (index.data().toString() == name)
+            return index;
+    }
+
+    return QModelIndex();
+}
+
+Qt::DropAction TreeModelDragTest::Drop(QTreeView& view, const QModelIndex& source, const QModelIndex& target, Qt::DropAction action)
+{
+    view.setDragDropMode(QAbstractItemView::DragDrop);
+    view.setDefaultDropAction(action);
+    view.viewport()->setAcceptDrops(true);
+    view.resize(400, 300);
+    view.show();
+    view.expandAll();
+
+    if (!QTest::qWaitForWindowExposed(&view))
+        return Qt::IgnoreAction;
+
+    view.selectionModel()->select(source, QItemSelectionModel::ClearAndSelect | QItemSelectionModel::Rows);
+    std::unique_ptr<QMimeData> data(view.model()->mimeData({ source }));
+
+    // The middle of the target row drops onto it rather than above or below. A drop is only
+    // delivered to the widget that accepted the drag entering it.
+    QPoint position = view.visualRect(target).center();
+
+    QDragEnterEvent enter(position, action, data.get(), Qt::LeftButton, Qt::NoModifier);
+    QCoreApplication::sendEvent(view.viewport(), &enter);
+    if (!enter.isAccepted())
+        return Qt::IgnoreAction;
+
+    QDropEvent drop(position, action, data.get(), Qt::LeftButton, Qt::NoModifier);
+    QCoreApplication::sendEvent(view.viewport(), &drop);
+
+    Qt::DropAction dropped = drop.isAccepted() ? drop.dropAction() : Qt::IgnoreAction;
+
+    // QAbstractItemView::startDrag after a move: clearOrRemove() on the current selection.
+    if (dropped == Qt::MoveAction) {
+        const auto rows = view.selectionModel()->selectedRows();
+        for (auto it = rows.crbegin(); it != rows.crend(); ++it)
+            view.model()->removeRow(it->row(), it->parent());
+    }
+
+    return dropped;
+}
+
+QTEST_MAIN(TreeModelDragTest)
+#include "treemodeldragtest.moc"
@@ -0,0 +1,63 @@
+#ifndef TREE_H
+#define TREE_H
+
+#include "column.h"
+#include "leafpathset.h"
+#include <QHash>
+#include <QList>
+#include <QMap>
+#include <QString>
+
+struct Node {
+    int id { 0 };
+    QString name { "" };
+    QString description { "" };
+
+    Node* parent { nullptr };
+    QList<Node*> children;
+
+    Node(int id, QString name, QString description)
+        : id { id }
+        , name { name }
+        , description { description }
+    {
+    }
+
+    ~Node()
+    {
+        qDeleteAll(children);
+    }
+};
+
+inline constexpr std::array<Column<Node>, 3> kNodeColumns {
+    MakeColumn<&Node::name>("Account", "name", true, Qt::ItemIsDragEnabled | Qt::ItemIsDropEnabled),
+    MakeColumn<&Node::id>("Id", nullptr, false),
+    MakeColumn<&Node::description>("Description", "description", true),
+};
+struct TreeInfo {
+    QString node { "" };
+    QString node_path { "" };
+    QString transaction { "" };
+    ColumnSet<Node> columns { kNodeColumns };
+
+    TreeInfo(QString node, QString node_path, QString transaction = "", ColumnSet<Node> columns = kNodeColumns)
+        : node { node }
+        , node_path { node_path }
+        , transaction { transaction }
+        , columns { columns }
+    {
+    }
+};
+
+// Node graph and leaf paths of one tree, built off the GUI thread and handed to a model.
+struct TreeData {
+    Node* root { nullptr };
+    QHash<int, Node*> node_hash;
+    LeafPathSet leaf_paths;
+    qint64 change_seq { 0 };
+    // Loaded nodes whose children are not, with the size of what is below them. Empty
+    // unless the graph was loaded to a limited depth.
+    QHash<int, int> hidden;
+};
+
+#endif // TREE_H
@@ -0,0 +1,452 @@
+#include "treeloader.h"
+#include "profiler.h"
+#include "schema.h"
+#include "stringinterner.h"
+#include "treesnapshot.h"
+#include <QDebug>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QtConcurrent>
+
+namespace {
+// Read the change log position first, anything committed while we load is replayed afterwards.
+qint64 ChangeSeq(const QSqlDatabase& db)
+{
+    auto query = QSqlQuery(db);
+    SqlTrace trace(query);
+
+    query.prepare("SELECT COALESCE(MAX(seq), 0) FROM tree_change");
+    if (trace.Exec() && trace.Next())
+        return query.value(0).toLongLong();
+
+    return 0;
+}
+
+// Pool ids of the names of all nodes below root, taken under one lock of the pool.
+QHash<const Node*, int> NameIds(const Node* root, StringInterner* pool)
+{
+    QList<const Node*> nodes;
+    QStringList names;
+
+    QList<const Node*> stack(root->children.cbegin(), root->children.cend());
+    while (!stack.isEmpty()) {
+        const Node* node = stack.takeLast();
+        nodes << node;
+        names << node->name;
+
+        for (const Node* child : node->children)
+            stack << child;
+    }
+
+    const auto ids = pool->Ids(names);
+
+    QHash<const Node*, int> name_ids;
+    name_ids.reserve(nodes.size());
+
+    for (int i = 0; i != nodes.size(); ++i)
+        name_ids.insert(nodes.at(i), ids.at(i));
+
+    return name_ids;
+}
+
+// prefix holds the pool ids of the ancestors of node, it grows and shrinks with the walk
+// so every segment is looked up once per node instead of once per leaf below it.
+void VisitLeaves(const Node* node, QVector<int>& prefix, const QHash<int, int>& hidden,
+    const QHash<const Node*, int>& name_ids, LeafPathSet& leaf_paths)
+{
+    prefix.append(name_ids.value(node));
+
+    if (!node->children.isEmpty()) {
+        for (const Node* child : node->children)
+            VisitLeaves(child, prefix, hidden, name_ids, leaf_paths);
+    } else if (!hidden.contains(node->id)) {
+        leaf_paths.Insert(node->id, prefix);
+    }
+
+    prefix.removeLast();
+}
+}
+
+TreeData TreeLoader::Load(const QSqlDatabase& db, const TreeInfo& tree_info, StringInterner* interner, QChar separator)
+{
+    TreeData data;
+    data.change_seq = ChangeSeq(db);
+
+    if (LoadSnapshot(db, tree_info, data, interner, separator))
+        return data;
+
+    data.root = ConstructTree(db, tree_info, data.node_hash, interner);
+    data.leaf_paths = ConstructLeafPaths(db, tree_info, data.root, data.hidden, interner, separator);
+
+    SaveSnapshot(db, tree_info, data.root);
+    return data;
+}
+
+TreeData TreeLoader::LoadLevels(const QSqlDatabase& db, const TreeInfo& tree_info, int depth,
+    StringInterner* interner, QChar separator)
+{
+    TreeData data;
+    data.change_seq = ChangeSeq(db);
+    data.root = new Node(-1, "root", "");
+
+    auto query = QSqlQuery(db);
+    SqlTrace trace(query);
+    query.setForwardOnly(true);
+
+    // Walks down from the top level nodes through the (ancestor, distance) index, the CROSS
+    // JOIN keeps SQLite from scanning the whole path table instead. Parents come first.
+    query.prepare(QString("SELECT n.id, n.name, n.description, e.ancestor, "
+                          "CASE WHEN c.distance = :depth - 1 THEN (SELECT COUNT(*) - 1 FROM %1 s WHERE s.ancestor = n.id) ELSE 0 END "
+                          "FROM %2 r "
+                          "CROSS JOIN %1 c ON c.ancestor = r.id AND c.distance < :depth "
+                          "INNER JOIN %2 n ON n.id = c.descendant "
+                          "LEFT JOIN %1 e ON e.descendant = c.descendant AND e.distance = 1 "
+                          "WHERE NOT EXISTS (SELECT 1 FROM %1 t WHERE t.descendant = r.id AND t.distance = 1) "
+                          "ORDER BY c.distance")
+                      .arg(tree_info.node_path, tree_info.node));
+    query.bindValue(":depth", qMax(depth, 1));
+
+    if (!trace.Exec()) {
+        qWarning() << "Error query tree levels" << query.lastError().text();
+        return data;
+    }
+
+    while (trace.Next()) {
+        int id = query.value(0).toInt();
+        QString name = query.value(1).toString();
+        QString description = query.value(2).toString();
+
+        if (interner) {
+            name = interner->Intern(name);
+            description = interner->Intern(description);
+        }
+
+        auto* node = new Node(id, name, description);
+        Node* node_parent = data.node_hash.value(query.value(3).toInt(), data.root);
+
+        node->parent = node_parent;
+        node_parent->children.append(node);
+        data.node_hash.insert(id, node);
+
+        int below = query.value(4).toInt();
+        if (below > 0)
+            data.hidden.insert(id, below);
+    }
+
+    data.leaf_paths = ConstructLeafPaths(db, tree_info, data.root, data.hidden, interner, separator);
+    return data;
+}
+
+QList<Node*> TreeLoader::LoadChildren(const QSqlDatabase& db, const TreeInfo& tree_info, int id,
+    QHash<int, int>& hidden, StringInterner* interner)
+{
+    auto query = QSqlQuery(db);
+    SqlTrace trace(query);
+    query.setForwardOnly(true);
+
+    query.prepare(QString("SELECT n.id, n.name, n.description, (SELECT COUNT(*) - 1 FROM %1 s WHERE s.ancestor = n.id) "
+                          "FROM %1 c INNER JOIN %2 n ON n.id = c.descendant "
+                          "WHERE c.ancestor = :id AND c.distance = 1")
+                      .arg(tree_info.node_path, tree_info.node));
+    query.bindValue(":id", id);
+
+    QList<Node*> children;
+
+    if (!trace.Exec()) {
+        qWarning() << "Error query children of" << id << query.lastError().text();
+        return children;
+    }
+
+    while (trace.Next()) {
+        QString name = query.value(1).toString();
+        QString description = query.value(2).toString();
+
+        if (interner) {
+            name = interner->Intern(name);
+            description = interner->Intern(description);
+        }
+
+        auto* node = new Node(query.value(0).toInt(), name, description);
+        children << node;
+
+        int below = query.value(3).toInt();
+        if (below > 0)
+            hidden.insert(node->id, below);
+    }
+
+    return children;
+}
+
+Node* TreeLoader::ConstructTree(const QSqlDatabase& db, const TreeInfo& tree_info, QHash<int, Node*>& node_hash, StringInterner* interner)
+{
+    auto query = QSqlQuery(db);
+    SqlTrace trace(query);
+
+    query.prepare(QString("SELECT id, name, description FROM %1").arg(tree_info.node));
+
+    if (!trace.Exec()) {
+        qWarning() << "Error query data from node"
+                   << query.lastError().text();
+    }
+
+    auto* root = new Node(-1, "root", "");
+
+    node_hash.clear();
+
+    int id = 0;
+    QString name;
+    QString description;
+
+    while (trace.Next()) {
+        id = query.value(0).toInt();
+        name = query.value(1).toString();
+        description = query.value(2).toString();
+
+        if (interner) {
+            name = interner->Intern(name);
+            description = interner->Intern(description);
+        }
+
+        node_hash[id] = new Node(id, name, description);
+    }
+
+    if (query.lastError().isValid()) {
+        qWarning() << "Error construct TABLE NODE:" << query.lastError().text();
+    } else if (!query.isActive()) {
+        qWarning() << "TABLE NODE is not active";
+    }
+
+    query.prepare(QString("SELECT ancestor, descendant FROM %1 WHERE distance = 1").arg(tree_info.node_path));
+    if (!trace.Exec()) {
+        qWarning() << "Error query data from node path"
+                   << query.lastError().text();
+    }
+
+    int descendant_id = 0;
+    int ancestor_id = 0;
+    Node* ancestor;
+    Node* descendant;
+    int dangling = 0;
+
+    while (trace.Next()) {
+        ancestor_id = query.value(0).toInt();
+        descendant_id = query.value(1).toInt();
+
+        ancestor = node_hash.value(ancestor_id);
+        descendant = node_hash.value(descendant_id);
+
+        if (ancestor && descendant) {
+            ancestor->children.emplace_back(descendant);
+            descendant->parent = ancestor;
+        } else {
+            ++dangling;
+        }
+    }
+
+    if (dangling)
+        qWarning() << dangling << "edges of" << tree_info.node_path << "reference missing nodes, run ClosureChecker";
+
+    if (query.lastError().isValid()) {
+        qWarning() << "Error construct TABLE NODE_PATH:" << query.lastError().text();
+    } else if (!query.isActive()) {
+        qWarning() << "TABLE NODE_PATHis not active";
+    }
+
+    for (auto* node : qAsConst(node_hash)) {
+        if (!node->parent) {
+            node->parent = root;
+            root->children.emplace_back(node);
+        }
+    }
+
+    return root;
+}
+
+LeafPathSet TreeLoader::ConstructLeafPaths(const QSqlDatabase& db, const TreeInfo& tree_info,
+    const Node* root, const QHash<int, int>& hidden, StringInterner* interner, QChar c)
+{
+    qint64 begin = Profiler::Now();
+
+    // Without the registry's pool the set owns one for this load, the walks share it.
+    LeafPathSet leaf_paths(interner, c);
+    StringInterner* pool = leaf_paths.Pool();
+    QList<const Node*> tops(root->children.cbegin(), root->children.cend());
+
+    // Pooled up front, the workers only read the ids and never wait for each other on the pool.
+    const auto name_ids = NameIds(root, pool);
+
+    auto Walk = [&hidden, &name_ids, pool, c](const Node* top) {
+        LeafPathSet leaf_paths(pool, c);
+        QVector<int> prefix;
+        VisitLeaves(top, prefix, hidden, name_ids, leaf_paths);
+        return leaf_paths;
+    };
+
+    for (const auto& partial : QtConcurrent::blockingMapped<QList<LeafPathSet>>(tops, Walk))
+        leaf_paths.Merge(partial);
+
+    // Recorded next to the statements so the trace still shows where leaf paths come from.
+    Profiler::Record("ConstructLeafPaths in memory", begin, Profiler::Now() - begin, leaf_paths.Size());
+
+    if (!hidden.isEmpty())
+        ConstructHiddenLeafPaths(db, tree_info, hidden, leaf_paths);
+
+    return leaf_paths;
+}
+
+void TreeLoader::ConstructHiddenLeafPaths(const QSqlDatabase& db, const TreeInfo& tree_info,
+    const QHash<int, int>& hidden, LeafPathSet& leaf_paths)
+{
+    auto query = QSqlQuery(db);
+    SqlTrace trace(query);
+    query.setForwardOnly(true);
+
+    // Leaves below all collapsed nodes in one statement, the ids travel as a JSON array. One
+    // row per segment with the top level ancestor first.
+    query.prepare(QString("SELECT p.descendant, p.ancestor, n.name FROM %1 p "
+                          "INNER JOIN %2 n ON n.id = p.ancestor "
+                          "WHERE p.descendant IN (SELECT h.descendant FROM %1 h "
+                          "WHERE h.ancestor IN (SELECT value FROM json_each(:ids)) AND h.distance > 0 "
+                          "AND NOT EXISTS (SELECT 1 FROM %1 c WHERE c.ancestor = h.descendant AND c.distance = 1)) "
+                          "ORDER BY p.descendant, p.distance DESC")
+                      .arg(tree_info.node_path, tree_info.node));
+
+    QStringList ids;
+    ids.reserve(hidden.size());
+    for (auto it = hidden.cbegin(); it != hidden.cend(); ++it)
+        ids << QString::number(it.key());
+
+    query.bindValue(":ids", QString("[%1]").arg(ids.join(',')));
+
+    if (!trace.Exec()) {
+        qWarning() << "Error query leaf paths below collapsed nodes" << query.lastError().text();
+        return;
+    }
+
+    // The same ancestors come back for every leaf below them, each is pooled once.
+    StringInterner* pool = leaf_paths.Pool();
+    QHash<int, int> name_ids;
+
+    int id = 0;
+    QVector<int> path;
+
+    while (trace.Next()) {
+        int descendant = query.value(0).toInt();
+
+        if (descendant != id) {
+            if (id)
+                leaf_paths.Insert(id, path);
+
+            id = descendant;
+            path.clear();
+        }
+
+        int ancestor = query.value(1).toInt();
+        auto it = name_ids.constFind(ancestor);
+        if (it == name_ids.constEnd())
+            it = name_ids.insert(ancestor, pool->Id(query.value(2).toString()));
+
+        path << *it;
+    }
+
+    if (id)
+        leaf_paths.Insert(id, path);
+}
+
+Node* TreeLoader::LoadSubtree(const QSqlDatabase& db, const TreeInfo& tree_info, int id,
+    QHash<int, Node*>& nodes, StringInterner* interner)
+{
+    auto query = QSqlQuery(db);
+    SqlTrace trace(query);
+    query.setForwardOnly(true);
+
+    // Parents come before their children when ordered by distance from the subtree root.
+    query.prepare(QString("SELECT n.id, n.name, n.description, e.ancestor FROM %1 c "
+                          "INNER JOIN %2 n ON n.id = c.descendant "
+                          "LEFT JOIN %1 e ON e.descendant = c.descendant AND e.distance = 1 "
+                          "WHERE c.ancestor = :id ORDER BY c.distance")
+                      .arg(tree_info.node_path, tree_info.node));
+    query.bindValue(":id", id);
+
+    if (!trace.Exec()) {
+        qWarning() << "Error query subtree" << query.lastError().text();
+        return nullptr;
+    }
+
+    Node* subtree = nullptr;
+
+    while (trace.Next()) {
+        QString name = query.value(1).toString();
+        QString description = query.value(2).toString();
+
+        if (interner) {
+            name = interner->Intern(name);
+            description = interner->Intern(description);
+        }
+
+        auto* node = new Node(query.value(0).toInt(), name, description);
+        nodes.insert(node->id, node);
+
+        if (!subtree) {
+            subtree = node;
+            continue;
+        }
+
+        Node* node_parent = nodes.value(query.value(3).toInt(), subtree);
+        node->parent = node_parent;
+        node_parent->children.append(node);
+    }
+
+    return subtree;
+}
+
+QString TreeLoader::SnapshotPath(const QSqlDatabase& db, const TreeInfo& tree_info)
+{
+    auto database = db.databaseName();
+    if (database.isEmpty() || database == ":memory:")
+        return QString();
+
+    return QString("%1.%2.snapshot").arg(database, tree_info.node);
+}
+
+bool TreeLoader::LoadSnapshot(const QSqlDatabase& db, const TreeInfo& tree_info, TreeData& data,
+    StringInterner* interner, QChar separator)
+{
+    auto file_name = SnapshotPath(db, tree_info);
+    if (file_name.isEmpty())
+        return false;
+
+    auto* root = TreeSnapshot::Read(file_name, Schema::DataVersion(db, tree_info.node));
+    if (!root)
+        return false;
+
+    data.root = root;
+    data.node_hash.clear();
+
+    std::function<void(Node*)> Index = [&data, interner, &Index](Node* node) {
+        for (Node* child : node->children) {
+            if (interner) {
+                child->name = interner->Intern(child->name);
+                child->description = interner->Intern(child->description);
+            }
+
+            data.node_hash.insert(child->id, child);
+            Index(child);
+        }
+    };
+    Index(root);
+
+    data.leaf_paths = ConstructLeafPaths(db, tree_info, root, data.hidden, interner, separator);
+    return true;
+}
+
+bool TreeLoader::SaveSnapshot(const QSqlDatabase& db, const TreeInfo& tree_info, const Node* root)
+{
+    auto file_name = SnapshotPath(db, tree_info);
+    qint64 version = Schema::DataVersion(db, tree_info.node);
+
+    if (file_name.isEmpty() || version < 0)
+        return false;
+
+    return TreeSnapshot::Write(file_name, version, root);
+}
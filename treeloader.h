@@ -0,0 +1,46 @@
+#ifndef TREELOADER_H
+#define TREELOADER_H
+
+#include "tree.h"
+#include <QSqlDatabase>
+
+class StringInterner;
+
+// Builds the node graph and leaf paths of one tree from its closure table, or from the
+// snapshot next to the database while that is still current. Needs nothing but the
+// connection, so it runs on worker threads and in the command line tool alike.
+
+class TreeLoader {
+public:
+    static TreeData Load(const QSqlDatabase& db, const TreeInfo& tree_info,
+        StringInterner* interner = nullptr, QChar separator = '/');
+
+    // Only the top depth levels, the nodes on the last one list their descendants in hidden.
+    static TreeData LoadLevels(const QSqlDatabase& db, const TreeInfo& tree_info, int depth,
+        StringInterner* interner = nullptr, QChar separator = '/');
+    // Children of id, those with children of their own are added to hidden.
+    static QList<Node*> LoadChildren(const QSqlDatabase& db, const TreeInfo& tree_info, int id,
+        QHash<int, int>& hidden, StringInterner* interner);
+
+    static Node* ConstructTree(const QSqlDatabase& db, const TreeInfo& tree_info,
+        QHash<int, Node*>& node_hash, StringInterner* interner);
+    // Leaves are the childless nodes of the graph, those below the collapsed nodes in hidden
+    // come from the closure table in one query. Top level subtrees are walked in parallel.
+    static LeafPathSet ConstructLeafPaths(const QSqlDatabase& db, const TreeInfo& tree_info,
+        const Node* root, const QHash<int, int>& hidden, StringInterner* interner, QChar c);
+
+    // Detached branch below id, every node of it is added to nodes.
+    static Node* LoadSubtree(const QSqlDatabase& db, const TreeInfo& tree_info, int id,
+        QHash<int, Node*>& nodes, StringInterner* interner);
+
+    static bool SaveSnapshot(const QSqlDatabase& db, const TreeInfo& tree_info, const Node* root);
+
+private:
+    static void ConstructHiddenLeafPaths(const QSqlDatabase& db, const TreeInfo& tree_info,
+        const QHash<int, int>& hidden, LeafPathSet& leaf_paths);
+    static QString SnapshotPath(const QSqlDatabase& db, const TreeInfo& tree_info);
+    static bool LoadSnapshot(const QSqlDatabase& db, const TreeInfo& tree_info, TreeData& data,
+        StringInterner* interner, QChar separator);
+};
+
+#endif // TREELOADER_H
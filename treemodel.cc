@@ -1,140 +1,569 @@
 ﻿#include "treemodel.h"
+#include "profiler.h"
+#include "sqlwriter.h"
+#include "statementcache.h"
+#include "stringinterner.h"
+#include "subtreestream.h"
+#include "treeloader.h"
+#include <QBuffer>
+#include <QCoreApplication>
 #include <QDebug>
 #include <QIODevice>
+#include <QLocale>
 #include <QMimeData>
+#include <QPointer>
+#include <QPromise>
+#include <QSet>
 #include <QSqlError>
 #include <QSqlQuery>
+#include <QTimer>
+#include <utility>
+
+namespace {
+const int kChangeInterval = 1000;
+const int kChangeRetention = 100000;
+const int kPruneInterval = 60; // polls
+
+QVariant Result(bool result)
+{
+    return result ? QVariant(true) : QVariant();
+}
+
+QVariant Result(int id)
+{
+    return id ? QVariant(id) : QVariant();
+}
+
+template <typename T>
+QFuture<T> Ready(const T& value)
+{
+    QPromise<T> promise;
+    promise.start();
+    promise.addResult(value);
+    promise.finish();
+    return promise.future();
+}
+
+// Writes the dragged branch only when a drop target outside the model asks for it, drags
+// within the view never run the queries.
+class SubtreeMimeData : public QMimeData {
+public:
+    explicit SubtreeMimeData(std::function<QByteArray()> write)
+        : write { std::move(write) }
+    {
+    }
+
+    QStringList formats() const override
+    {
+        return QMimeData::formats() << SubtreeStream::kMimeType;
+    }
+
+protected:
+    QVariant retrieveData(const QString& mime_type, QMetaType type) const override
+    {
+        if (mime_type != SubtreeStream::kMimeType)
+            return QMimeData::retrieveData(mime_type, type);
+
+        if (write)
+            stream = std::exchange(write, nullptr)();
+
+        return stream;
+    }
+
+private:
+    mutable std::function<QByteArray()> write;
+    mutable QByteArray stream;
+};
+}
 
 TreeModel::TreeModel(const QSqlDatabase& db, const TreeInfo& tree_info, QObject* parent)
+    : TreeModel(db, tree_info, TreeLoader::Load(db, tree_info), nullptr, nullptr, nullptr, parent)
+{
+}
+
+TreeModel::TreeModel(const QSqlDatabase& db, const TreeInfo& tree_info, const TreeData& data,
+    StringInterner* interner, StatementCache* statements, SqlWriter* writer, QObject* parent)
     : QAbstractItemModel { parent }
     , root { nullptr }
     , tree_info { tree_info }
     , db { db }
+    , store { db, tree_info, statements }
+    , columns { tree_info.columns }
+    , interner { interner }
+    , writer { writer }
 {
-    headers << "Account"
-            << "Id"
-            << "Description";
+    if (!writer) {
+        own_writer = std::make_unique<SqlWriter>(db);
+        this->writer = own_writer.get();
+    }
+
+    Adopt(data);
 
-    ConstructTree(db);
-    ConstructLeafPaths(db, separator);
+    connect(this, &QAbstractItemModel::dataChanged, this, &TreeModel::InvalidateFormat);
+    connect(this, &QAbstractItemModel::modelReset, this, [this]() { format_cache.Clear(); });
+    connect(this, &QAbstractItemModel::layoutChanged, this, [this]() { format_cache.Clear(); });
+    connect(this, &QAbstractItemModel::rowsRemoved, this, [this]() { format_cache.Clear(); });
+    connect(this, &QAbstractItemModel::rowsMoved, this, [this]() { format_cache.Clear(); });
+
+    StartChangeTracking();
 }
 
 TreeModel::~TreeModel()
 {
+    // A snapshot of the top levels would pass for the whole tree on the next start, and one of
+    // a graph that is ahead of or apart from the database would be trusted just the same.
+    if (!depth_limit && InSync())
+        TreeLoader::SaveSnapshot(db, tree_info, root);
+
+    qDeleteAll(placeholders);
     delete root;
 }
 
-void TreeModel::ConstructTree(const QSqlDatabase& db)
+void TreeModel::Adopt(const TreeData& data)
 {
+    root = data.root;
+    node_hash = data.node_hash;
+    leaf_paths = data.leaf_paths;
+    hidden = data.hidden;
+    change_seq = qMax(change_seq, data.change_seq);
+
+    ResetPlaceholders();
+}
+
+QFuture<QVariant> TreeModel::Write(std::function<QVariant(ClosureStore& store)> edit)
+{
+    return Submit([tree_info = tree_info, edit](const QSqlDatabase& db, StatementCache& statements) {
+        ClosureStore store(db, tree_info, &statements);
+        return edit(store);
+    });
+}
+
+QFuture<QVariant> TreeModel::Submit(std::function<QVariant(const QSqlDatabase& db, StatementCache& statements)> job)
+{
+    auto written = writer->Submit(std::move(job));
+
+    // Counted here so InSync() knows about writes no caller has reconciled yet.
+    ++pending_writes;
+
+    return written.then(this, [this](const QVariant& result) {
+        --pending_writes;
+        if (!result.isValid())
+            ++failed_writes;
+
+        return result;
+    });
+}
+
+int TreeModel::PendingWrites() const
+{
+    return pending_writes;
+}
+
+bool TreeModel::InSync() const
+{
+    // Written, reconciled and caught up with the change log, which our own writes reach too.
+    if (pending_writes || failed_writes)
+        return false;
 
     auto query = QSqlQuery(db);
+    SqlTrace trace(query);
 
-    query.prepare(QString("SELECT id, name, description FROM %1").arg(tree_info.node));
+    query.prepare("SELECT COALESCE(MAX(seq), 0) FROM tree_change WHERE name = :name");
+    query.bindValue(":name", tree_info.node);
+
+    return trace.Exec() && trace.Next() && query.value(0).toLongLong() <= change_seq;
+}
+
+QFuture<bool> TreeModel::Reconcile(QFuture<QVariant> written)
+{
+    return written.then(this, [this](const QVariant& result) {
+        if (result.isValid())
+            return true;
+
+        // The graph shows an edit the database refused, start over from what is committed.
+        qWarning() << "A write to" << tree_info.node << "failed, reloading";
+        Reload();
+        return false;
+    });
+}
+
+int TreeModel::ReserveIds(int count)
+{
+    // Ids are handed out here rather than by the writer, so rows shown before their commit
+    // never need renumbering. Should another process take one first, that write fails and
+    // Reconcile reloads.
+    next_id = qMax(next_id, store.NextId());
+    if (!next_id)
+        return 0;
+
+    int first = next_id;
+    next_id += count;
+    return first;
+}
 
-    if (!query.exec()) {
-        qWarning() << "Error query data from node"
-                   << query.lastError().text();
+void TreeModel::Reload()
+{
+    if (depth_limit)
+        Reset(TreeLoader::LoadLevels(db, tree_info, depth_limit, interner, separator));
+    else
+        Reset(TreeLoader::Load(db, tree_info, interner, separator));
+}
+
+void TreeModel::Reset(const TreeData& data)
+{
+    beginResetModel();
+
+    // The graph is what the database holds now, failures before this are settled.
+    delete root;
+    Adopt(data);
+    failed_writes = 0;
+
+    endResetModel();
+
+    UpdateLeafPaths();
+}
+
+void TreeModel::SetDepthLimit(int depth)
+{
+    depth = qMax(depth, 0);
+    if (depth == depth_limit)
+        return;
+
+    depth_limit = depth;
+    Reload();
+}
+
+int TreeModel::DepthLimit() const
+{
+    return depth_limit;
+}
+
+void TreeModel::StartChangeTracking()
+{
+    PruneChanges();
+
+    auto query = QSqlQuery(db);
+    SqlTrace trace(query);
+
+    query.prepare("PRAGMA data_version");
+    if (trace.Exec() && trace.Next())
+        data_version = query.value(0).toLongLong();
+
+    change_timer = new QTimer(this);
+    connect(change_timer, &QTimer::timeout, this, &TreeModel::PollChanges);
+    change_timer->start(kChangeInterval);
+
+    // Catch up with whatever was committed between loading the graph and now.
+    ApplyChanges();
+}
+
+void TreeModel::PruneChanges()
+{
+    // Through the writer like every other write. Instances that fall behind the retained
+    // rows notice the gap and reload.
+    writer->Submit([](const QSqlDatabase& db, StatementCache& statements) {
+        Q_UNUSED(db);
+
+        auto& query = statements.Prepare("DELETE FROM tree_change WHERE seq <= (SELECT MAX(seq) FROM tree_change) - :retention");
+        SqlTrace trace(query);
+
+        query.bindValue(":retention", kChangeRetention);
+        if (!trace.Exec()) {
+            qWarning() << "Failed to prune tree_change" << query.lastError().text();
+            return QVariant();
+        }
+
+        return QVariant(true);
+    });
+}
+
+void TreeModel::PollChanges()
+{
+    // The log is written on every edit for the whole session, keep it bounded.
+    if (++polls % kPruneInterval == 0)
+        PruneChanges();
+
+    // data_version moves whenever another connection commits, the writer's included, so our own
+    // writes come back here as well. ApplyChanges finds them already in the graph.
+    auto query = QSqlQuery(db);
+    SqlTrace trace(query);
+
+    query.prepare("PRAGMA data_version");
+    if (!trace.Exec() || !trace.Next())
+        return;
+
+    qint64 version = query.value(0).toLongLong();
+    if (version == data_version)
+        return;
+
+    data_version = version;
+    ApplyChanges();
+}
+
+void TreeModel::ApplyChanges()
+{
+    auto query = QSqlQuery(db);
+    SqlTrace trace(query);
+
+    // Rows we have not seen were pruned by another instance, only a full reload is safe.
+    query.prepare("SELECT MIN(seq), MAX(seq) FROM tree_change");
+    if (!trace.Exec() || !trace.Next())
+        return;
+
+    if (!query.value(0).isNull() && query.value(0).toLongLong() > change_seq + 1) {
+        change_seq = query.value(1).toLongLong();
+        Reload();
+        return;
+    }
+
+    query.prepare("SELECT seq, row, operation FROM tree_change WHERE name = :name AND seq > :seq ORDER BY seq");
+    query.bindValue(":name", tree_info.node);
+    query.bindValue(":seq", change_seq);
+    if (!trace.Exec()) {
+        qWarning() << "Error query data from tree_change" << query.lastError().text();
+        return;
     }
 
-    root = new Node(-1, "root", "");
+    QSet<int> inserted;
+    QSet<int> updated;
+    QSet<int> moved;
+    QSet<int> removed;
+    bool reload = false;
+
+    while (trace.Next()) {
+        change_seq = query.value(0).toLongLong();
+        int id = query.value(1).toInt();
+        auto operation = query.value(2).toString();
+
+        if (operation == "insert")
+            inserted.insert(id);
+        else if (operation == "update")
+            updated.insert(id);
+        else if (operation == "move")
+            moved.insert(id);
+        else if (operation == "delete")
+            removed.insert(id);
+        else if (operation == "reload")
+            reload = true;
+    }
+
+    if (reload) {
+        Reload();
+        return;
+    }
 
-    QHash<int, Node*> hash;
+    if (inserted.isEmpty() && updated.isEmpty() && moved.isEmpty() && removed.isEmpty())
+        return;
 
-    int id = 0;
     QString name;
     QString description;
 
-    while (query.next()) {
-        id = query.value(0).toInt();
-        name = query.value(1).toString();
-        description = query.value(2).toString();
-        hash[id] = new Node(id, name, description);
+    // Our own writes come back here too, an insert of many children logs a move per child.
+    // The parents of every loaded or new node are read in one statement, not one each.
+    QList<int> placed;
+    placed.reserve(moved.size() + inserted.size());
+
+    for (int id : qAsConst(moved)) {
+        if (node_hash.contains(id))
+            placed << id;
     }
 
-    if (query.lastError().isValid()) {
-        qWarning() << "Error construct TABLE NODE:" << query.lastError().text();
-    } else if (!query.isActive()) {
-        qWarning() << "TABLE NODE is not active";
+    for (int id : qAsConst(inserted)) {
+        if (!node_hash.contains(id))
+            placed << id;
     }
 
-    query.prepare(QString("SELECT ancestor, descendant FROM %1 WHERE distance = 1").arg(tree_info.node_path));
-    if (!query.exec()) {
-        qWarning() << "Error query data from node path"
-                   << query.lastError().text();
+    // A reload replaces the whole graph, it is decided before anything is detached from it.
+    QHash<int, int> parents;
+    reload = !store.FetchParents(placed, parents);
+
+    for (int id : qAsConst(moved)) {
+        // Moved below a collapsed level, only a reload takes it out of the loaded ones.
+        if (reload || (node_hash.contains(id) && IsCollapsed(parents.value(id)))) {
+            reload = true;
+            break;
+        }
     }
 
-    int descendant_id = 0;
-    int ancestor_id = 0;
-    Node* ancestor;
-    Node* descendant;
+    for (int id : qAsConst(removed)) {
+        // Its collapsed children moved up to its parent.
+        if (reload || (hidden.contains(id) && node_hash.contains(id) && !store.FetchNode(id, name, description))) {
+            reload = true;
+            break;
+        }
+    }
+
+    if (reload) {
+        Reload();
+        return;
+    }
 
-    while (query.next()) {
-        ancestor_id = query.value(0).toInt();
-        descendant_id = query.value(1).toInt();
+    // Every step compares the database with the in-memory graph, so replaying our own writes is a no-op.
+    QList<Node*> detached;
+    bool changed = false;
 
-        ancestor = hash.value(ancestor_id);
-        descendant = hash.value(descendant_id);
+    auto FetchNode = [this, &name, &description](int id) {
+        if (!store.FetchNode(id, name, description))
+            return false;
 
-        if (ancestor && descendant) {
-            ancestor->children.emplace_back(descendant);
-            descendant->parent = ancestor;
+        if (interner) {
+            name = interner->Intern(name);
+            description = interner->Intern(description);
         }
+
+        return true;
+    };
+
+    for (int id : qAsConst(inserted)) {
+        if (node_hash.contains(id) || !FetchNode(id))
+            continue;
+
+        auto* node = new Node(id, name, description);
+        node_hash.insert(id, node);
+        detached << node;
+        moved.remove(id);
+        changed = true;
     }
 
-    if (query.lastError().isValid()) {
-        qWarning() << "Error construct TABLE NODE_PATH:" << query.lastError().text();
-    } else if (!query.isActive()) {
-        qWarning() << "TABLE NODE_PATHis not active";
+    bool progress = true;
+    while (!detached.isEmpty() && progress) {
+        progress = false;
+
+        for (auto it = detached.begin(); it != detached.end();) {
+            int parent_id = parents.value((*it)->id, -1);
+
+            // Inserted below a collapsed level, it shows up once that level is expanded.
+            if (IsCollapsed(parent_id)) {
+                node_hash.remove((*it)->id);
+                delete *it;
+                it = detached.erase(it);
+                progress = true;
+                continue;
+            }
+
+            Node* node_parent = node_hash.value(parent_id, root);
+
+            if (node_parent != root && !node_parent->parent) {
+                ++it;
+                continue;
+            }
+
+            MoveNode(*it, node_parent);
+            it = detached.erase(it);
+            progress = true;
+        }
     }
 
-    for (auto* node : qAsConst(hash)) {
+    // Whatever cannot be attached is dropped rather than left outside the graph.
+    for (Node* node : qAsConst(detached)) {
+        MoveNode(node, root);
+
         if (!node->parent) {
-            node->parent = root;
-            root->children.emplace_back(node);
+            node_hash.remove(node->id);
+            delete node;
         }
     }
-}
 
-void TreeModel::ConstructLeafPaths(const QSqlDatabase& db, QChar c)
-{
-    leaf_paths.clear();
+    for (int id : qAsConst(moved)) {
+        Node* node = node_hash.value(id);
+        if (!node || !parents.contains(id))
+            continue;
 
-    auto query = QSqlQuery(db);
-    query.prepare(QString("SELECT n1.id FROM %1 n1 "
-                          "INNER JOIN %2 n2 ON n1.id = n2.ancestor "
-                          "GROUP BY n1.id, n1.name "
-                          "HAVING COUNT(n2.ancestor) = 1;")
-                      .arg(tree_info.node, tree_info.node_path));
-    if (!query.exec()) {
-        qWarning() << "Error query data from node path"
-                   << query.lastError().text();
+        Node* node_parent = node_hash.value(parents.value(id), root);
+
+        if (node->parent != node_parent) {
+            MoveNode(node, node_parent);
+            changed = true;
+        }
     }
 
-    Node* node;
-    while (query.next()) {
+    for (int id : qAsConst(removed)) {
+        Node* node = node_hash.value(id);
+        if (!node || store.FetchNode(id, name, description))
+            continue;
 
-        int id = query.value(0).toInt();
-        node = GetNode(root, id);
+        while (!node->children.isEmpty())
+            MoveNode(node->children.last(), node->parent);
 
-        QString path = node->name;
+        Node* node_parent = node->parent;
+        int row = node_parent->children.indexOf(node);
 
-        while (node->parent != root) {
-            node = node->parent;
-            path = node->name + c + path;
-        }
+        beginRemoveRows(GetIndex(node_parent), row, row);
+        node_parent->children.removeAt(row);
+        node_hash.remove(id);
+        delete node;
+        endRemoveRows();
+
+        updated.remove(id);
+        changed = true;
+    }
 
-        leaf_paths[path] = id;
+    for (int id : qAsConst(updated)) {
+        Node* node = node_hash.value(id);
+        if (!node || !FetchNode(id))
+            continue;
+
+        if (node->name == name && node->description == description)
+            continue;
+
+        changed |= node->name != name;
+        node->name = name;
+        node->description = description;
+
+        QModelIndex index = GetIndex(node);
+        emit dataChanged(index, index.siblingAtColumn(columnCount() - 1));
+    }
+
+    // Writes of our own writer come back through the log as well, they leave the paths alone.
+    if (!changed)
+        return;
+
+    leaf_paths = TreeLoader::ConstructLeafPaths(db, tree_info, root, hidden, interner, separator);
+    UpdateLeafPaths();
+}
+
+void TreeModel::MoveNode(Node* node, Node* new_parent)
+{
+    if (!node || !new_parent || node == new_parent || node->parent == new_parent || IsDescendant(new_parent, node))
+        return;
+
+    Node* old_parent = node->parent;
+    int destination = new_parent->children.size();
+
+    if (!old_parent) {
+        beginInsertRows(GetIndex(new_parent), destination, destination);
+        new_parent->children.append(node);
+        node->parent = new_parent;
+        endInsertRows();
+        return;
     }
+
+    int row = old_parent->children.indexOf(node);
+
+    if (!beginMoveRows(GetIndex(old_parent), row, row, GetIndex(new_parent), destination))
+        return;
+
+    old_parent->children.removeAt(row);
+    new_parent->children.append(node);
+    node->parent = new_parent;
+
+    endMoveRows();
 }
 
 QModelIndex TreeModel::index(int row, int column, const QModelIndex& parent) const
 {
+    Profiler::Count(Counter::kIndex);
+
     if (!hasIndex(row, column, parent))
         return QModelIndex();
 
     auto* node_parent = GetNode(parent);
     auto* node = node_parent->children.value(row);
 
+    // The placeholder of a collapsed level follows the loaded children.
+    if (!node && row == node_parent->children.size())
+        node = placeholders.value(node_parent->id);
+
     if (node)
         return createIndex(row, column, node);
 
@@ -143,6 +572,8 @@ QModelIndex TreeModel::index(int row, int column, const QModelIndex& parent) con
 
 QModelIndex TreeModel::parent(const QModelIndex& index) const
 {
+    Profiler::Count(Counter::kParent);
+
     if (!index.isValid())
         return QModelIndex();
 
@@ -164,95 +595,137 @@ int TreeModel::rowCount(const QModelIndex& parent) const
 {
     auto* node_parent = GetNode(parent);
 
-    return node_parent->children.size();
+    return node_parent->children.size() + (placeholders.contains(node_parent->id) ? 1 : 0);
+}
+
+bool TreeModel::hasChildren(const QModelIndex& parent) const
+{
+    // A placeholder gets an expander, expanding it asks fetchMore for its rows.
+    return IsPlaceholder(GetNode(parent)) || rowCount(parent) > 0;
+}
+
+bool TreeModel::canFetchMore(const QModelIndex& parent) const
+{
+    return IsPlaceholder(GetNode(parent));
+}
+
+void TreeModel::fetchMore(const QModelIndex& parent)
+{
+    Node* node = GetNode(parent);
+    if (!IsPlaceholder(node))
+        return;
+
+    // The view asks while it lays out the expanded row, the row is replaced once it is done.
+    QMetaObject::invokeMethod(
+        this, [this, id = node->parent->id]() { ExpandPlaceholder(id); }, Qt::QueuedConnection);
 }
 
 QVariant TreeModel::data(const QModelIndex& index, int role) const
 {
-    if (!index.isValid() || role != Qt::DisplayRole)
+    Profiler::Count(Counter::kData);
+
+    if (!index.isValid())
         return QVariant();
 
     auto* node = static_cast<Node*>(index.internalPointer());
 
-    switch (index.column()) {
-    case 0:
-        return node->name;
-    case 1:
-        return node->id;
-    case 2:
-        return node->description;
-    default:
-        return QVariant();
-    }
+    if (IsPlaceholder(node))
+        return index.column() == 0 && role == Qt::DisplayRole ? QVariant(node->name) : QVariant();
 
-    return QVariant();
+    if (role == Qt::EditRole)
+        return columns[index.column()].get(*node);
+
+    return format_cache.Value(node, index.column(), role, [this](const Node& node) { return FormatRow(node); });
 }
 
-bool TreeModel::setData(const QModelIndex& index, const QVariant& value, int role)
+QVector<QVariant> TreeModel::FormatRow(const Node& node) const
 {
-    if (!index.isValid() || role != Qt::EditRole)
-        return false;
+    QVector<QVariant> values(columns.size * kFormatRoleCount);
 
-    auto* node = static_cast<Node*>(index.internalPointer());
+    QString path = node.name;
+    for (const Node* ancestor = node.parent; ancestor && ancestor != root; ancestor = ancestor->parent)
+        path = ancestor->name + separator + path;
 
-    switch (index.column()) {
-    case 0:
-        break;
-    case 1:
-        break;
-    case 2:
-        node->description = value.toString();
-        emit dataChanged(index, index, QVector<int>() << role);
-        UpdateRecord(node->id, "description", value.toString());
-        return true;
+    for (int column = 0; column != columns.size; ++column) {
+        values[column * kFormatRoleCount] = columns[column].display(node);
+        values[column * kFormatRoleCount + 1] = int(columns[column].alignment);
+        values[column * kFormatRoleCount + 2] = path;
     }
 
-    return false;
+    return values;
 }
 
-int TreeModel::columnCount(const QModelIndex& parent) const
+void TreeModel::InvalidateFormat(const QModelIndex& top_left, const QModelIndex& bottom_right)
 {
-    Q_UNUSED(parent)
-    return headers.size();
+    // A new name changes the path tooltip of the whole subtree.
+    if (top_left.column() == 0) {
+        format_cache.Clear();
+        return;
+    }
+
+    for (int row = top_left.row(); row <= bottom_right.row(); ++row)
+        format_cache.Remove(static_cast<Node*>(top_left.siblingAtRow(row).internalPointer()));
 }
 
-bool TreeModel::UpdateRecord(int id, QString column, QString string)
+bool TreeModel::setData(const QModelIndex& index, const QVariant& value, int role)
 {
+    if (role != Qt::EditRole)
+        return false;
 
-    QSqlQuery query = QSqlQuery(db);
-    query.prepare(QString("UPDATE %1 SET %2 = :string WHERE id = :id").arg(tree_info.node, column));
-    query.bindValue(":id", id);
-    query.bindValue(":string", string);
+    return !Update(index, value).isCanceled();
+}
 
-    if (!query.exec()) {
-        qWarning() << "Failed to edit record:" << query.lastError().text();
-        return false;
+QFuture<bool> TreeModel::Update(const QModelIndex& index, const QVariant& value)
+{
+    if (!index.isValid())
+        return QFuture<bool>();
+
+    auto* node = static_cast<Node*>(index.internalPointer());
+    if (IsPlaceholder(node))
+        return QFuture<bool>();
+
+    const auto& column = columns[index.column()];
+    bool rename = column.sql && qstrcmp(column.sql, "name") == 0;
+
+    if (rename && !IsValidName(value.toString()))
+        return QFuture<bool>();
+
+    if (!column.set || !column.set(*node, value))
+        return QFuture<bool>();
+
+    emit dataChanged(index, index, QVector<int>() << Qt::EditRole);
+
+    if (!column.sql)
+        return Ready(true);
+
+    auto written = Write([id = node->id, sql = QString(column.sql), value](ClosureStore& store) { return Result(store.Update(id, sql, value)); });
+
+    if (rename) {
+        if (interner)
+            node->name = interner->Intern(node->name);
+
+        written = RefreshLeafPaths(QList<int>(), { node }, QList<const Node*>(), written);
     }
-    return true;
+
+    return Reconcile(written);
+}
+
+int TreeModel::columnCount(const QModelIndex& parent) const
+{
+    Q_UNUSED(parent)
+    return columns.size;
 }
 
 void TreeModel::sort(int column, Qt::SortOrder order)
 {
-    emit layoutAboutToBeChanged();
+    if (!columns.Contains(column))
+        return;
 
-    auto Compare = [column, order](const Node* lhs, const Node* rhs) -> bool {
-        bool result;
-        switch (column) {
-        case 0:
-            result = lhs->name < rhs->name;
-            break;
-        case 1:
-            result = lhs->id < rhs->id;
-            break;
-        case 2:
-            result = lhs->description < rhs->description;
-            break;
-        default:
-            result = false;
-            break;
-        }
+    emit layoutAboutToBeChanged();
 
-        return order == Qt::AscendingOrder ? result : !result;
+    auto Less = columns[column].less;
+    auto Compare = [Less, order](const Node* lhs, const Node* rhs) -> bool {
+        return order == Qt::AscendingOrder ? Less(*lhs, *rhs) : Less(*rhs, *lhs);
     };
 
     std::function<void(Node*)> Sort =
@@ -280,21 +753,105 @@ Node* TreeModel::GetNode(const QModelIndex& index) const
     return root;
 }
 
-Node* TreeModel::GetNode(Node* parent, int id)
+QModelIndex TreeModel::GetIndex(Node* node) const
 {
-    if (!parent)
-        return nullptr;
+    if (!node || node == root || !node->parent)
+        return QModelIndex();
 
-    for (Node* child : parent->children) {
-        if (child->id == id)
-            return child;
+    return createIndex(node->parent->children.indexOf(node), 0, node);
+}
 
-        Node* node = GetNode(child, id);
+void TreeModel::ResetPlaceholders()
+{
+    qDeleteAll(placeholders);
+    placeholders.clear();
+
+    for (auto it = hidden.cbegin(); it != hidden.cend(); ++it) {
+        Node* node = node_hash.value(it.key());
         if (node)
-            return node;
+            placeholders.insert(node->id, CreatePlaceholder(node, it.value()));
+    }
+}
+
+Node* TreeModel::CreatePlaceholder(Node* node_parent, int count) const
+{
+    auto* placeholder = new Node(0, tr("%1 more accounts...").arg(QLocale().toString(count)), "");
+    placeholder->parent = node_parent;
+    return placeholder;
+}
+
+bool TreeModel::IsPlaceholder(const Node* node) const
+{
+    // Stored nodes start at 1 and the root is -1.
+    return node && node->id == 0;
+}
+
+bool TreeModel::IsCollapsed(int id) const
+{
+    return depth_limit && id > 0 && !node_hash.contains(id);
+}
+
+bool TreeModel::HasHidden(const Node* node) const
+{
+    if (hidden.isEmpty())
+        return false;
+
+    if (hidden.contains(node->id))
+        return true;
+
+    for (const Node* child : node->children) {
+        if (HasHidden(child))
+            return true;
     }
 
-    return nullptr;
+    return false;
+}
+
+void TreeModel::ExpandPlaceholder(int id)
+{
+    Node* node_parent = node_hash.value(id);
+    Node* placeholder = placeholders.value(id);
+    if (!node_parent || !placeholder)
+        return;
+
+    QModelIndex parent = GetIndex(node_parent);
+    int row = node_parent->children.size();
+
+    beginRemoveRows(parent, row, row);
+    placeholders.remove(id);
+    hidden.remove(id);
+    endRemoveRows();
+
+    delete placeholder;
+
+    QHash<int, int> below;
+    QList<Node*> children;
+
+    // Nodes inserted or moved here since the level was loaded are in memory already.
+    for (Node* child : TreeLoader::LoadChildren(db, tree_info, id, below, interner)) {
+        if (node_hash.contains(child->id))
+            delete child;
+        else
+            children << child;
+    }
+
+    if (children.isEmpty())
+        return;
+
+    beginInsertRows(parent, row, row + children.size() - 1);
+
+    for (Node* child : qAsConst(children)) {
+        child->parent = node_parent;
+        node_parent->children.append(child);
+        node_hash.insert(child->id, child);
+
+        if (below.contains(child->id)) {
+            hidden.insert(child->id, below.value(child->id));
+            placeholders.insert(child->id, CreatePlaceholder(child, below.value(child->id)));
+        }
+    }
+
+    endInsertRows();
 }
 
 bool TreeModel::IsDescendant(Node* descendant, Node* ancestor)
@@ -315,64 +872,126 @@ bool TreeModel::IsDescendant(Node* descendant, Node* ancestor)
     return false;
 }
 
+bool TreeModel::IsValidName(const QString& name) const
+{
+    // Leaves are addressed by their path, an empty segment or one holding the separator
+    // would make them unreachable.
+    return !name.trimmed().isEmpty() && !name.contains(separator);
+}
+
 void TreeModel::UpdateLeafPaths()
 {
     emit LeafPaths(leaf_paths);
 }
 
-bool TreeModel::insertRows(int row, int count, const QModelIndex& parent)
+QFuture<QVariant> TreeModel::RefreshLeafPaths(QList<int> ids, const QList<const Node*>& subtrees, const QList<const Node*>& nodes,
+    QFuture<QVariant> written)
 {
-    if (count != 1)
-        return false;
+    bool collapsed = false;
+    for (const Node* subtree : subtrees)
+        collapsed |= HasHidden(subtree);
+
+    // Leaves below a collapsed level are not in memory, they are read back once the edit is
+    // committed. A future takes one continuation, the caller chains on the returned one.
+    if (collapsed) {
+        return written.then(this, [this](const QVariant& result) {
+            leaf_paths = TreeLoader::ConstructLeafPaths(db, tree_info, root, hidden, interner, separator);
+            UpdateLeafPaths();
+            return result;
+        });
+    }
 
-    auto* node_parent = GetNode(parent);
+    for (const Node* subtree : subtrees)
+        PatchLeafPaths(subtree, ids);
 
-    InsertRecord(node_parent->id, "New Node");
-    auto* new_node = new Node(id_last_insert, "New Node", "");
+    for (const Node* node : nodes)
+        PatchLeaf(node, ids);
 
-    beginInsertRows(parent, row, row);
+    if (!ids.isEmpty())
+        emit LeafPathsChanged(leaf_paths, ids);
 
-    new_node->parent = node_parent;
-    node_parent->children.insert(row, new_node);
+    return written;
+}
 
-    endInsertRows();
+void TreeModel::PatchLeafPaths(const Node* node, QList<int>& ids)
+{
+    // Every leaf below node gets its segments rebuilt, nothing outside the subtree is touched.
+    PatchLeaf(node, ids);
 
-    ConstructLeafPaths(db, separator);
-    UpdateLeafPaths();
+    for (const Node* child : node->children)
+        PatchLeafPaths(child, ids);
+}
 
-    return true;
+void TreeModel::PatchLeaf(const Node* node, QList<int>& ids)
+{
+    if (!node || node == root)
+        return;
+
+    if (node->children.isEmpty() && !hidden.contains(node->id)) {
+        leaf_paths.Insert(node, root);
+        ids << node->id;
+    } else if (leaf_paths.Contains(node->id)) {
+        leaf_paths.Remove(node->id);
+        ids << node->id;
+    }
 }
 
-bool TreeModel::InsertRecord(int id_parent, QString name)
+bool TreeModel::insertRows(int row, int count, const QModelIndex& parent)
 {
+    if (count < 1)
+        return false;
 
-    auto query = QSqlQuery(db);
+    return !InsertChildren(parent, QStringList(count, "New Node"), row).isCanceled();
+}
 
-    query.prepare(QString("INSERT INTO %1 (name) VALUES (:name)").arg(tree_info.node));
-    query.bindValue(":name", name);
+QFuture<int> TreeModel::InsertChildren(const QModelIndex& parent, const QStringList& names, int row)
+{
+    auto* node_parent = GetNode(parent);
+    if (names.isEmpty() || IsPlaceholder(node_parent))
+        return QFuture<int>();
 
-    if (!query.exec()) {
-        qWarning() << "Failed to add node" << query.lastError().text();
-        return false;
+    for (const QString& name : names) {
+        if (!IsValidName(name))
+            return QFuture<int>();
     }
 
-    id_last_insert = query.lastInsertId().toInt();
+    int first = ReserveIds(names.size());
+    if (!first)
+        return QFuture<int>();
 
-    query.prepare(QString(
-        "INSERT INTO %1 (ancestor, descendant, distance) "
-        "SELECT ancestor, :id, distance + 1 "
-        "FROM %1 WHERE descendant = :parent "
-        "UNION ALL SELECT :id, :id, 0")
-                      .arg(tree_info.node_path));
-    query.bindValue(":id", id_last_insert);
-    query.bindValue(":parent", id_parent);
+    // In front of the placeholder row, if there is one.
+    row = row < 0 ? node_parent->children.size() : qMin(row, int(node_parent->children.size()));
 
-    if (!query.exec()) {
-        qWarning() << "Failed to add node_path"
-                   << query.lastError().text();
-        return false;
+    QList<Node*> nodes;
+    nodes.reserve(names.size());
+
+    for (int i = 0; i != names.size(); ++i) {
+        auto* node = new Node(first + i, interner ? interner->Intern(names.at(i)) : names.at(i), "");
+        node->parent = node_parent;
+        nodes << node;
     }
-    return true;
+
+    beginInsertRows(parent, row, row + nodes.size() - 1);
+
+    node_parent->children = node_parent->children.mid(0, row) + nodes + node_parent->children.mid(row);
+    for (Node* node : qAsConst(nodes))
+        node_hash.insert(node->id, node);
+
+    endInsertRows();
+
+    auto written = Write([id_parent = node_parent->id, names, first](ClosureStore& store) { return Result(store.InsertChildren(id_parent, names, first)); });
+
+    // The new nodes are leaves and node_parent may have stopped being one, nothing else moved.
+    QList<int> ids;
+    ids.reserve(nodes.size() + 1);
+
+    for (const Node* node : qAsConst(nodes))
+        PatchLeaf(node, ids);
+    PatchLeaf(node_parent, ids);
+
+    emit LeafPathsChanged(leaf_paths, ids);
+
+    return Reconcile(written).then([first](bool committed) { return committed ? first : 0; });
 }
 
 bool TreeModel::removeRows(int row, int count, const QModelIndex& parent)
@@ -380,107 +999,185 @@ bool TreeModel::removeRows(int row, int count, const QModelIndex& parent)
     if (row < 0 || count != 1)
         return false;
 
-    auto* node_parent = GetNode(parent);
-    Node* node = node_parent->children.at(row);
+    return !Remove(index(row, 0, parent)).isCanceled();
+}
+
+QFuture<bool> TreeModel::Remove(const QModelIndex& index)
+{
+    auto* node = index.isValid() ? static_cast<Node*>(index.internalPointer()) : nullptr;
+    if (!node || IsPlaceholder(node))
+        return QFuture<bool>();
+
+    Node* node_parent = node->parent;
+    QModelIndex parent = GetIndex(node_parent);
+    int row = node_parent->children.indexOf(node);
     int id = node->id;
 
-    beginRemoveRows(parent, row, row);
+    auto written = Write([id](ClosureStore& store) { return Result(store.Remove(id)); });
+
+    // Its collapsed children move up to node_parent, whose loaded rows no longer tell the whole story.
+    if (hidden.contains(id)) {
+        return written.then(this, [this](const QVariant& result) {
+            Reload();
+            return result.isValid();
+        });
+    }
+
+    QList<int> ids;
+    if (leaf_paths.Contains(id))
+        ids << id;
+
+    leaf_paths.Remove(id);
+    QList<const Node*> children(node->children.cbegin(), node->children.cend());
 
-    if (!node_parent->children.isEmpty()) {
-        for (Node* child : node->children) {
+    // The children take the node's place, announced as a move of their own so views never see
+    // rows appear inside the remove bracket.
+    if (!node->children.isEmpty()) {
+        int count = node->children.size();
+        beginMoveRows(index.siblingAtColumn(0), 0, count - 1, parent, row + 1);
+
+        for (Node* child : qAsConst(node->children))
             child->parent = node_parent;
-            node_parent->children.emplace_back(child);
-        }
+
+        node_parent->children = node_parent->children.mid(0, row + 1) + node->children + node_parent->children.mid(row + 1);
+        node->children.clear();
+
+        endMoveRows();
     }
 
-    node_parent->children.removeOne(node);
+    beginRemoveRows(parent, row, row);
+
+    node_parent->children.removeAt(row);
+    node_hash.remove(id);
     delete node;
     node = nullptr;
 
     endRemoveRows();
 
-    DeleteRecord(id, node_parent->id);
+    return Reconcile(RefreshLeafPaths(ids, children, { node_parent }, written));
+}
+
+QFuture<bool> TreeModel::Move(const QModelIndex& index, const QModelIndex& parent, int row)
+{
+    auto* node = index.isValid() ? static_cast<Node*>(index.internalPointer()) : nullptr;
+    Node* node_parent = GetNode(parent);
 
-    ConstructLeafPaths(db, separator);
-    UpdateLeafPaths();
+    if (!node || IsPlaceholder(node) || IsPlaceholder(node_parent) || node == node_parent
+        || node->parent == node_parent || IsDescendant(node_parent, node))
+        return QFuture<bool>();
 
-    return true;
+    Node* old_parent = node->parent;
+    int from = old_parent->children.indexOf(node);
+    int to = row < 0 ? node_parent->children.size() : qMin(row, int(node_parent->children.size()));
+
+    if (!beginMoveRows(GetIndex(old_parent), from, from, GetIndex(node_parent), to))
+        return QFuture<bool>();
+
+    old_parent->children.removeAt(from);
+    node_parent->children.insert(to, node);
+    node->parent = node_parent;
+
+    endMoveRows();
+
+    auto written = Write([id = node->id, id_parent = node_parent->id](ClosureStore& store) { return Result(store.Move(id, id_parent)); });
+
+    return Reconcile(RefreshLeafPaths(QList<int>(), { node }, { old_parent, node_parent }, written));
 }
 
-bool TreeModel::DeleteRecord(int id, int id_parent)
+QFuture<int> TreeModel::Copy(const QModelIndex& index, const QModelIndex& parent)
 {
-    QSqlQuery query = QSqlQuery(db);
+    auto* node = index.isValid() ? static_cast<Node*>(index.internalPointer()) : nullptr;
+    Node* node_parent = GetNode(parent);
 
-    query.prepare(QString("DELETE FROM %1 WHERE id = :id").arg(tree_info.node));
-    query.bindValue(":id", id);
-    if (!query.exec()) {
-        qWarning() << "Failed to remove node 1st step" << query.lastError().text();
-        return false;
-    }
+    if (!node || IsPlaceholder(node) || IsPlaceholder(node_parent))
+        return QFuture<int>();
 
-    query.prepare(QString(
-        "UPDATE %1 SET distance = distance -1 WHERE "
-        "(descendant IN (SELECT descendant FROM %1 WHERE ancestor = :id AND ancestor != descendant) "
-        "AND ancestor IN (SELECT ancestor FROM %1 WHERE descendant = :id AND ancestor != descendant))")
-                      .arg(tree_info.node_path));
-    query.bindValue(":id", id);
-    if (!query.exec()) {
-        qWarning() << "Failed to remove node_path 2nd step"
-                   << query.lastError().text();
-        return false;
-    }
+    // The copied nodes get a reserved range, so optimistic inserts queued in the meantime do
+    // not take the same ids and the copy can be shown with the ids the writer will give it.
+    int base = ReserveIds(SubtreeSize(node));
+    if (!base)
+        return QFuture<int>();
 
-    query.prepare(QString(
-        "DELETE FROM %1 "
-        "WHERE descendant = :id OR ancestor = :id")
-                      .arg(tree_info.node_path));
-    query.bindValue(":id", id);
-    if (!query.exec()) {
-        qWarning() << "Failed to remove node_path 3rd step"
-                   << query.lastError().text();
-        return false;
+    auto written = Write([id = node->id, id_parent = node_parent->id, base](ClosureStore& store) { return Result(store.Copy(id, id_parent, base)); });
+
+    // Levels below a collapsed node are not in memory, that copy is read back once committed.
+    if (HasHidden(node)) {
+        return written.then(this, [this, id_parent = node_parent->id](const QVariant& result) {
+            int copy = result.toInt();
+            Node* node_parent = id_parent == root->id ? root : node_hash.value(id_parent);
+
+            // Change tracking may have picked the copy up first.
+            if (!copy || !node_parent || !AttachSubtree(copy, node_parent))
+                return copy;
+
+            RefreshLeafPaths(QList<int>(), { node_hash.value(copy) }, { node_parent }, Ready(QVariant(true)));
+            return copy;
+        });
     }
 
-    return true;
+    Node* copy = CopySubtree(node, base);
+    int row = node_parent->children.size();
+
+    beginInsertRows(GetIndex(node_parent), row, row);
+    copy->parent = node_parent;
+    node_parent->children.append(copy);
+    endInsertRows();
+
+    return Reconcile(RefreshLeafPaths(QList<int>(), { copy }, { node_parent }, written)).then([base](bool committed) {
+        return committed ? base : 0;
+    });
 }
 
-bool TreeModel::DragRecord(int id, int new_parent)
+Node* TreeModel::CopySubtree(const Node* node, int base)
 {
-    QSqlQuery query = QSqlQuery(db);
+    // Level by level from node, by id within a level, the order of the writer's ROW_NUMBER().
+    QHash<const Node*, int> ids;
+    QList<const Node*> level { node };
 
-    query.prepare(QString("DELETE FROM %1 WHERE "
-                          "(descendant IN (SELECT descendant FROM %1 WHERE ancestor = :id) AND "
-                          "ancestor IN (SELECT ancestor FROM %1 WHERE descendant = :id AND ancestor != descendant))")
-                      .arg(tree_info.node_path));
-    query.bindValue(":id", id);
-    if (!query.exec()) {
-        qWarning() << "Failed to drag node_path 1st step"
-                   << query.lastError().text();
-        return false;
-    }
+    while (!level.isEmpty()) {
+        std::sort(level.begin(), level.end(), [](const Node* lhs, const Node* rhs) { return lhs->id < rhs->id; });
 
-    query.prepare(QString("INSERT INTO %1 (ancestor, descendant, distance) "
-                          "SELECT p.ancestor, s.descendant, p.distance + s.distance + 1 "
-                          "FROM %1 p "
-                          "CROSS JOIN %1 s "
-                          "WHERE p.descendant = :new_parent AND s.ancestor = :id")
-                      .arg(tree_info.node_path));
-    query.bindValue(":id", id);
-    query.bindValue(":new_parent", new_parent);
+        QList<const Node*> below;
+        for (const Node* source : qAsConst(level)) {
+            ids.insert(source, base++);
 
-    if (!query.exec()) {
-        qWarning() << "Failed to drag node_path 2nd step"
-                   << query.lastError().text();
-        return false;
+            for (const Node* child : source->children)
+                below << child;
+        }
+
+        level = below;
     }
 
-    return true;
+    std::function<Node*(const Node*)> Clone = [this, &ids, &Clone](const Node* source) {
+        auto* copy = new Node(ids.value(source), source->name, source->description);
+
+        for (const Node* child : source->children) {
+            Node* child_copy = Clone(child);
+            child_copy->parent = copy;
+            copy->children.append(child_copy);
+        }
+
+        node_hash.insert(copy->id, copy);
+        return copy;
+    };
+
+    return Clone(node);
+}
+
+int TreeModel::SubtreeSize(const Node* node) const
+{
+    int size = 1 + hidden.value(node->id);
+
+    for (const Node* child : node->children)
+        size += SubtreeSize(child);
+
+    return size;
 }
 
 QVariant TreeModel::headerData(int section, Qt::Orientation orientation, int role) const
 {
-    if (orientation == Qt::Horizontal && role == Qt::DisplayRole)
-        return headers.at(section);
+    if (orientation == Qt::Horizontal && role == Qt::DisplayRole && columns.Contains(section))
+        return columns[section].header;
 
     return QVariant();
 }
@@ -490,19 +1187,10 @@ Qt::ItemFlags TreeModel::flags(const QModelIndex& index) const
     if (!index.isValid())
         return Qt::NoItemFlags;
 
-    auto default_flags = QAbstractItemModel::flags(index);
+    if (IsPlaceholder(static_cast<Node*>(index.internalPointer())))
+        return Qt::ItemIsEnabled;
 
-    switch (index.column()) {
-    case 0:
-        return Qt::ItemIsDragEnabled | Qt::ItemIsDropEnabled | default_flags;
-        break;
-    case 1:
-        return default_flags;
-        break;
-    default:
-        return Qt::ItemIsEditable | default_flags;
-        break;
-    }
+    return columns[index.column()].flags | QAbstractItemModel::flags(index);
 }
 
 Qt::DropActions TreeModel::supportedDropActions() const
@@ -513,13 +1201,36 @@ Qt::DropActions TreeModel::supportedDropActions() const
 QStringList TreeModel::mimeTypes() const
 {
     QStringList types;
-    types << "application/id";
+    types << "application/id" << SubtreeStream::kMimeType;
     return types;
 }
 
 QMimeData* TreeModel::mimeData(const QModelIndexList& indexes) const
 {
-    QMimeData* data_mime = new QMimeData();
+    // Other windows and processes cannot resolve our ids, they import the serialised branch.
+    QList<int> top_ids;
+    for (const Node* node : TopNodes(indexes))
+        top_ids << node->id;
+
+    QMimeData* data_mime = new SubtreeMimeData([model = QPointer<const TreeModel>(this), top_ids]() {
+        QByteArray stream;
+        if (!model)
+            return stream;
+
+        QList<const Node*> nodes;
+        for (int id : top_ids) {
+            if (const Node* node = model->node_hash.value(id))
+                nodes << node;
+        }
+
+        QBuffer buffer(&stream);
+        buffer.open(QIODevice::WriteOnly);
+        if (!model->WriteSubtrees(&buffer, nodes, false))
+            stream.clear();
+
+        return stream;
+    });
+
     QByteArray data_encoded;
 
     QDataStream stream(&data_encoded, QIODevice::WriteOnly);
@@ -529,7 +1240,7 @@ QMimeData* TreeModel::mimeData(const QModelIndexList& indexes) const
     for (const QModelIndex& index : indexes) {
         if (index.isValid()) {
             auto* node = static_cast<Node*>(index.internalPointer());
-            if (!nodes.contains(node))
+            if (!IsPlaceholder(node) && !nodes.contains(node))
                 nodes << node;
         }
     }
@@ -539,6 +1250,8 @@ QMimeData* TreeModel::mimeData(const QModelIndexList& indexes) const
     }
 
     data_mime->setData("application/id", data_encoded);
+    data_mime->setData("application/x-treemodel-source", SourceToken().toUtf8());
+
     return data_mime;
 }
 
@@ -548,7 +1261,7 @@ bool TreeModel::canDropMimeData(const QMimeData* data, Qt::DropAction action, in
     Q_UNUSED(column);
     Q_UNUSED(parent);
 
-    if (action == Qt::IgnoreAction || !data->hasFormat("application/id"))
+    if (action == Qt::IgnoreAction || !(data->hasFormat("application/id") || data->hasFormat(SubtreeStream::kMimeType)))
         return false;
 
     return true;
@@ -560,6 +1273,14 @@ bool TreeModel::dropMimeData(const QMimeData* data, Qt::DropAction action, int r
     if (!canDropMimeData(data, action, row, column, parent))
         return false;
 
+    if (data->data("application/x-treemodel-source") != SourceToken().toUtf8()) {
+        QByteArray stream = data->data(SubtreeStream::kMimeType);
+        QBuffer buffer(&stream);
+        buffer.open(QIODevice::ReadOnly);
+
+        return ImportSubtrees(&buffer, parent, action);
+    }
+
     QByteArray encodedData = data->data("application/id");
     QDataStream stream(&encodedData, QIODevice::ReadOnly);
     QList<int> ids;
@@ -571,37 +1292,208 @@ bool TreeModel::dropMimeData(const QMimeData* data, Qt::DropAction action, int r
     }
 
     Node* node_parent = GetNode(parent);
-    int begin_row = row == -1 ? node_parent->children.size() : row;
+    if (IsPlaceholder(node_parent))
+        return false;
+
+    int begin_row = row == -1 ? node_parent->children.size() : qMin(row, int(node_parent->children.size()));
 
-    Node* node;
+    // Neither waits for the writer, moves show up right away and copies once committed.
+    if (action == Qt::CopyAction) {
+        bool copied = false;
 
-    for (int id : ids) {
-        node = GetNode(root, id);
-        if (node) {
-            if (node->parent == node_parent || IsDescendant(node_parent, node)) {
+        for (int id : qAsConst(ids)) {
+            Node* node = node_hash.value(id);
+            if (!node)
                 continue;
-            }
 
-            QModelIndex index = createIndex(
-                node->parent->children.indexOf(node), 0, node);
+            // Copied along with a selected ancestor.
+            bool nested = false;
+            for (Node* ancestor = node->parent; ancestor && !nested; ancestor = ancestor->parent)
+                nested = ids.contains(ancestor->id);
+
+            if (!nested)
+                copied |= !Copy(GetIndex(node), GetIndex(node_parent)).isCanceled();
+        }
+
+        return copied;
+    }
+
+    // Move() rejects drops onto the node itself, its own parent or a descendant without
+    // writing anything, only the accepted ones take a row.
+    for (int id : qAsConst(ids)) {
+        Node* node = node_hash.value(id);
+        if (node && !Move(GetIndex(node), GetIndex(node_parent), begin_row).isCanceled())
+            ++begin_row;
+    }
+
+    // The rows are moved already. A drop reported as done would end the drag as a move, and the
+    // dragging view would then remove its selection, which followed the rows to their new place.
+    return false;
+}
+
+LeafPathSet TreeModel::GetLeafPaths() const
+{
+    return leaf_paths;
+}
+
+const TreeInfo& TreeModel::GetTreeInfo() const
+{
+    return tree_info;
+}
+
+const Node* TreeModel::GetRoot() const
+{
+    return root;
+}
+
+bool TreeModel::ExportSubtrees(const QModelIndexList& indexes, QIODevice* device, bool transactions) const
+{
+    return WriteSubtrees(device, TopNodes(indexes), transactions);
+}
+
+bool TreeModel::WriteSubtrees(QIODevice* device, const QList<const Node*>& nodes, bool transactions) const
+{
+    bool collapsed = false;
+    for (const Node* node : qAsConst(nodes))
+        collapsed |= HasHidden(node);
+
+    if (!collapsed)
+        return SubtreeStream(db, tree_info).Write(device, nodes, transactions);
+
+    // Part of the selection is not loaded, the complete branches are read for the export.
+    QHash<int, Node*> loaded;
+    QList<const Node*> subtrees;
+
+    for (const Node* node : qAsConst(nodes)) {
+        if (const Node* subtree = TreeLoader::LoadSubtree(db, tree_info, node->id, loaded, nullptr))
+            subtrees << subtree;
+    }
+
+    bool written = SubtreeStream(db, tree_info).Write(device, subtrees, transactions);
+    qDeleteAll(subtrees);
+
+    return written;
+}
+
+bool TreeModel::ImportSubtrees(QIODevice* device, const QModelIndex& parent, Qt::DropAction action)
+{
+    Node* node_parent = GetNode(parent);
+    if (IsPlaceholder(node_parent))
+        return false;
 
-            beginRemoveRows(index.parent(), index.row(), index.row());
-            node->parent->children.removeOne(node);
-            endRemoveRows();
+    if (action == Qt::MoveAction) {
+        auto roots = SubtreeStream(db, tree_info).LocalRoots(device);
+        QFuture<QVariant> written;
 
-            beginInsertRows(parent, begin_row, begin_row);
-            node_parent->children.insert(begin_row, node);
-            node->parent = node_parent;
-            endInsertRows();
+        for (int id : qAsConst(roots)) {
+            if (Node* node = node_hash.value(id)) {
+                Move(GetIndex(node), parent);
+                continue;
+            }
+
+            // Below a collapsed level, shown by the reload once the writer got to it.
+            written = Write([id, id_parent = node_parent->id](ClosureStore& store) { return Result(store.Move(id, id_parent)); });
         }
 
-        DragRecord(id, node_parent->id);
+        if (written.isValid())
+            written.then(this, [this](const QVariant&) { Reload(); });
+
+        if (!roots.isEmpty())
+            return false;
+
+        device->seek(0);
     }
 
+    // Imported by the writer like every other edit, from ids reserved next to the optimistic
+    // inserts. The device may be gone by the time the job runs, the job gets its bytes.
+    int count = SubtreeStream::CountNodes(device);
+    if (!count)
+        return false;
+
+    int first = ReserveIds(count);
+    if (!first)
+        return false;
+
+    auto written = Submit([tree_info = tree_info, separator = separator, stream = device->readAll(), id_parent = node_parent->id, first,
+                              count](const QSqlDatabase& db, StatementCache&) {
+        QBuffer buffer;
+        buffer.setData(stream);
+        buffer.open(QIODevice::ReadOnly);
+
+        QVariantList roots;
+        for (int id : SubtreeStream(db, tree_info, separator).Read(&buffer, id_parent, first, count))
+            roots << id;
+
+        return roots.isEmpty() ? QVariant() : QVariant(roots);
+    });
+
+    Reconcile(written.then(this, [this, id_parent = node_parent->id](const QVariant& result) {
+        Node* node_parent = id_parent == root->id ? root : node_hash.value(id_parent);
+        bool attached = false;
+
+        // Change tracking may have picked some of them up first.
+        for (const QVariant& id : result.toList())
+            attached |= node_parent && AttachSubtree(id.toInt(), node_parent);
+
+        if (attached) {
+            leaf_paths = TreeLoader::ConstructLeafPaths(db, tree_info, root, hidden, interner, separator);
+            UpdateLeafPaths();
+        }
+
+        return result;
+    }));
+
     return true;
 }
 
-QMap<QString, int> TreeModel::GetLeafPaths()
+bool TreeModel::AttachSubtree(int id, Node* parent)
 {
-    return leaf_paths;
+    if (node_hash.contains(id))
+        return false;
+
+    QHash<int, Node*> nodes;
+    Node* subtree = TreeLoader::LoadSubtree(db, tree_info, id, nodes, interner);
+    if (!subtree)
+        return false;
+
+    int row = parent->children.size();
+
+    beginInsertRows(GetIndex(parent), row, row);
+    subtree->parent = parent;
+    parent->children.append(subtree);
+    node_hash.insert(nodes);
+    endInsertRows();
+
+    return true;
+}
+
+QList<const Node*> TreeModel::TopNodes(const QModelIndexList& indexes) const
+{
+    QSet<const Node*> selected;
+    for (const QModelIndex& index : indexes) {
+        if (index.isValid())
+            selected.insert(static_cast<Node*>(index.internalPointer()));
+    }
+
+    // A node below another selected node travels with it.
+    QList<const Node*> nodes;
+    for (const QModelIndex& index : indexes) {
+        auto* node = static_cast<const Node*>(index.internalPointer());
+        if (!index.isValid() || IsPlaceholder(node) || nodes.contains(node))
+            continue;
+
+        bool nested = false;
+        for (const Node* ancestor = node->parent; ancestor && !nested; ancestor = ancestor->parent)
+            nested = selected.contains(ancestor);
+
+        if (!nested)
+            nodes << node;
+    }
+
+    return nodes;
+}
+
+QString TreeModel::SourceToken() const
+{
+    return QString("%1/%2").arg(QCoreApplication::applicationPid()).arg(quintptr(this));
 }
@@ -1,41 +1,35 @@
 ﻿#ifndef TREEMODEL_H
 #define TREEMODEL_H
 
+#include "closurestore.h"
+#include "formatcache.h"
+#include "tree.h"
 #include <QAbstractItemModel>
+#include <QFuture>
 #include <QSqlDatabase>
-
-struct Node {
-    int id { 0 };
-    QString name { "" };
-    QString description { "" };
-
-    Node* parent { nullptr };
-    QList<Node*> children;
-
-    Node(int id, QString name, QString description)
-        : id { id }
-        , name { name }
-        , description { description }
-    {
-    }
-};
-
-struct TreeInfo {
-    QString node { "" };
-    QString node_path { "" };
-
-    TreeInfo(QString node, QString node_path)
-        : node { node }
-        , node_path { node_path }
-    {
-    }
-};
+#include <functional>
+#include <memory>
+
+class QIODevice;
+class QTimer;
+class SqlWriter;
+class StatementCache;
+class StringInterner;
+
+// Qt item model over one tree. The graph comes from TreeLoader, reads go through the
+// model's connection and edits are queued on the writer as ClosureStore jobs. Edits are
+// applied in memory right away and nothing waits for the writer, ids of new rows are
+// reserved up front. A write that fails is reconciled by reloading the graph.
+// With a depth limit only the top levels are loaded, the children of a node on the last
+// level are summed up in a placeholder row that loads them when it is expanded.
 
 class TreeModel : public QAbstractItemModel {
     Q_OBJECT
 
 public:
     explicit TreeModel(const QSqlDatabase& db, const TreeInfo& tree_info, QObject* parent = nullptr);
+    TreeModel(const QSqlDatabase& db, const TreeInfo& tree_info, const TreeData& data,
+        StringInterner* interner, StatementCache* statements, SqlWriter* writer, QObject* parent = nullptr);
     ~TreeModel();
 
 public:
@@ -45,6 +39,10 @@ public:
 
     int rowCount(const QModelIndex& parent = QModelIndex()) const override;
     int columnCount(const QModelIndex& parent = QModelIndex()) const override;
+    bool hasChildren(const QModelIndex& parent = QModelIndex()) const override;
+
+    bool canFetchMore(const QModelIndex& parent) const override;
+    void fetchMore(const QModelIndex& parent) override;
 
     QVariant data(const QModelIndex& index,
         int role = Qt::DisplayRole) const override;
@@ -71,37 +69,108 @@ public:
         int column, const QModelIndex& parent) override;
 
 public:
-    QMap<QString, int> GetLeafPaths();
+    LeafPathSet GetLeafPaths() const;
+    const TreeInfo& GetTreeInfo() const;
+    const Node* GetRoot() const; // only the loaded levels while a depth limit is set
+    void Reload();
+
+    void Reset(const TreeData& data); // takes ownership of data.root
+
+    void SetDepthLimit(int depth); // 0 loads the whole tree
+    int DepthLimit() const;
+    int PendingWrites() const; // submitted, the model has not seen the result yet
+
+    // The futures report whether the write committed. An edit rejected up front returns a
+    // canceled future and changes nothing.
+    QFuture<int> InsertChildren(const QModelIndex& parent, const QStringList& names, int row = -1); // first id
+    QFuture<bool> Update(const QModelIndex& index, const QVariant& value);
+    QFuture<bool> Remove(const QModelIndex& index);
+    QFuture<bool> Move(const QModelIndex& index, const QModelIndex& parent, int row = -1);
+    // Shown right away, a source with collapsed levels is attached once the copy committed.
+    QFuture<int> Copy(const QModelIndex& index, const QModelIndex& parent);
+
+    bool ExportSubtrees(const QModelIndexList& indexes, QIODevice* device, bool transactions) const;
+    // A move from another model of this tree and database relinks the original nodes, which
+    // keep their ids and transactions, and returns false so the source does not remove them.
+    // Anything else is queued on the writer as new nodes, attached once committed.
+    bool ImportSubtrees(QIODevice* device, const QModelIndex& parent, Qt::DropAction action = Qt::CopyAction);
 
 signals:
-    void LeafPaths(const QMap<QString, int>& paths);
+    void LeafPaths(const LeafPathSet& paths);
+    // Only the listed leaves changed their path (or stopped being leaves), paths is the updated set.
+    void LeafPathsChanged(const LeafPathSet& paths, const QList<int>& ids);
 
 private:
-    bool InsertRecord(int id_parent, QString name);
-    bool UpdateRecord(int id, QString column, QString string);
-    bool DeleteRecord(int id, int id_parent);
-    bool DragRecord(int id, int new_parent);
-
-    void ConstructTree(const QSqlDatabase& db);
-    void ConstructLeafPaths(const QSqlDatabase& db, QChar c);
+    void Adopt(const TreeData& data);
+    QFuture<QVariant> Write(std::function<QVariant(ClosureStore& store)> edit);
+    QFuture<QVariant> Submit(std::function<QVariant(const QSqlDatabase& db, StatementCache& statements)> job);
+    bool InSync() const; // the graph matches the database, safe to snapshot
+    QFuture<bool> Reconcile(QFuture<QVariant> written);
+    int ReserveIds(int count);
+    int SubtreeSize(const Node* node) const;
+    Node* CopySubtree(const Node* node, int base); // numbered as ClosureStore::Copy numbers the rows
+
+    void StartChangeTracking();
+    void PollChanges();
+    void PruneChanges();
+    void ApplyChanges();
+    void MoveNode(Node* node, Node* new_parent);
+    bool AttachSubtree(int id, Node* parent);
+    QList<const Node*> TopNodes(const QModelIndexList& indexes) const;
+    bool WriteSubtrees(QIODevice* device, const QList<const Node*>& nodes, bool transactions) const;
+    QString SourceToken() const;
 
     Node* GetNode(const QModelIndex& index) const;
-    Node* GetNode(Node* parent, int id);
+    QModelIndex GetIndex(Node* node) const;
     bool IsDescendant(Node* descendant, Node* ancestor);
+    bool IsValidName(const QString& name) const;
+
+    void ResetPlaceholders();
+    Node* CreatePlaceholder(Node* node_parent, int count) const;
+    bool IsPlaceholder(const Node* node) const;
+    bool IsCollapsed(int id) const;
+    bool HasHidden(const Node* node) const;
+    void ExpandPlaceholder(int id);
 
     void UpdateLeafPaths();
+    // Returns written, or a future that follows it once the paths were read back.
+    QFuture<QVariant> RefreshLeafPaths(QList<int> ids, const QList<const Node*>& subtrees, const QList<const Node*>& nodes,
+        QFuture<QVariant> written);
+    void PatchLeafPaths(const Node* node, QList<int>& ids);
+    void PatchLeaf(const Node* node, QList<int>& ids);
+
+    QVector<QVariant> FormatRow(const Node& node) const;
+    void InvalidateFormat(const QModelIndex& top_left, const QModelIndex& bottom_right);
 
 private:
     Node* root;
 
     QSqlDatabase db;
     TreeInfo tree_info;
+    ClosureStore store;
 
-    int id_last_insert;
     QChar separator { '/' };
-    QStringList headers;
-
-    QMap<QString, int> leaf_paths;
+    ColumnSet<Node> columns;
+    FormatCache<Node> format_cache;
+
+    LeafPathSet leaf_paths;
+    QHash<int, Node*> node_hash;
+
+    StringInterner* interner { nullptr };
+    SqlWriter* writer { nullptr };
+    std::unique_ptr<SqlWriter> own_writer;
+    int next_id { 0 };
+    int pending_writes { 0 };
+    int failed_writes { 0 }; // since the last reset
+
+    int depth_limit { 0 };
+    QHash<int, int> hidden;
+    QHash<int, Node*> placeholders; // by parent id, not part of the graph
+
+    QTimer* change_timer { nullptr };
+    qint64 change_seq { 0 };
+    int polls { 0 };
+    qint64 data_version { 0 };
 };
 
 #endif // TREEMODEL_H
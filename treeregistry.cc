@@ -0,0 +1,133 @@
+#include "treeregistry.h"
+#include "treeloader.h"
+#include <QDebug>
+#include <QPromise>
+#include <QtConcurrent>
+
+namespace {
+TreeData LoadOnWorker(ConnectionManager* connections, const TreeInfo& tree_info, StringInterner* interner, int depth)
+{
+    auto db = connections->Reader();
+    if (!db.isOpen())
+        return TreeData();
+
+    if (depth)
+        return TreeLoader::LoadLevels(db, tree_info, depth, interner);
+
+    return TreeLoader::Load(db, tree_info, interner);
+}
+}
+
+TreeRegistry::TreeRegistry(const QSqlDatabase& db, ConnectionManager* connections, QObject* parent)
+    : QObject { parent }
+    , db { db }
+    , connections { connections }
+    , statements { db }
+{
+}
+
+TreeRegistry::~TreeRegistry()
+{
+    for (auto* watcher : qAsConst(watchers)) {
+        watcher->waitForFinished();
+        delete watcher->result().root;
+        delete watcher;
+    }
+
+    // Models go first, they still reference the shared statements.
+    qDeleteAll(models);
+}
+
+void TreeRegistry::Load(const QList<TreeInfo>& tree_infos)
+{
+    bool concurrent = connections->IsConcurrent();
+
+    for (const auto& tree_info : tree_infos) {
+        if (models.contains(tree_info.node))
+            continue;
+
+        // An in-memory database is private to its connection, load it where it lives.
+        if (!concurrent) {
+            Adopt(tree_info, TreeLoader::Load(db, tree_info, &interner));
+            continue;
+        }
+
+        auto* watcher = Watch(tree_info, 0);
+        connect(watcher, &QFutureWatcher<TreeData>::finished, this, [this, watcher, tree_info]() { Adopt(tree_info, watcher->result()); });
+    }
+}
+
+QFuture<bool> TreeRegistry::Reload(const QString& node)
+{
+    auto* model = models.value(node);
+    if (!model)
+        return QFuture<bool>();
+
+    if (!connections->IsConcurrent()) {
+        model->Reload();
+
+        QPromise<bool> promise;
+        promise.start();
+        promise.addResult(true);
+        promise.finish();
+        return promise.future();
+    }
+
+    // The model keeps serving its current graph until the new one is in.
+    auto* watcher = Watch(model->GetTreeInfo(), model->DepthLimit());
+    connect(watcher, &QFutureWatcher<TreeData>::finished, model, [watcher, model]() {
+        TreeData data = watcher->result();
+        if (data.root)
+            model->Reset(data);
+    });
+
+    return watcher->future().then([](const TreeData& data) { return data.root != nullptr; });
+}
+
+QFutureWatcher<TreeData>* TreeRegistry::Watch(const TreeInfo& tree_info, int depth)
+{
+    auto* watcher = new QFutureWatcher<TreeData>(this);
+    watchers << watcher;
+
+    // Connected first, so the watcher is off the list before anyone takes its result.
+    connect(watcher, &QFutureWatcher<TreeData>::finished, this, [this, watcher]() {
+        watchers.removeOne(watcher);
+        watcher->deleteLater();
+    });
+
+    watcher->setFuture(QtConcurrent::run(LoadOnWorker, connections, tree_info, &interner, depth));
+    return watcher;
+}
+
+TreeModel* TreeRegistry::Model(const QString& node) const
+{
+    return models.value(node);
+}
+
+QList<TreeModel*> TreeRegistry::Models() const
+{
+    return models.values();
+}
+
+StringInterner* TreeRegistry::Interner()
+{
+    return &interner;
+}
+
+void TreeRegistry::Adopt(const TreeInfo& tree_info, TreeData data)
+{
+    if (!data.root) {
+        qWarning() << "Loading" << tree_info.node << "on a worker failed, loading it on the GUI thread";
+        data = TreeLoader::Load(db, tree_info, &interner);
+    }
+
+    if (models.contains(tree_info.node)) {
+        delete data.root;
+        return;
+    }
+
+    auto* model = new TreeModel(db, tree_info, data, &interner, &statements, connections->Writer(), this);
+    models.insert(tree_info.node, model);
+
+    emit TreeLoaded(model);
+}
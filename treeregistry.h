@@ -0,0 +1,50 @@
+#ifndef TREEREGISTRY_H
+#define TREEREGISTRY_H
+
+#include "connectionmanager.h"
+#include "statementcache.h"
+#include "stringinterner.h"
+#include "treemodel.h"
+#include <QFuture>
+#include <QFutureWatcher>
+#include <QObject>
+
+// Hosts every tree of one database. Trees are loaded concurrently on worker threads,
+// each reading through its own connection, and the models are created on the GUI thread
+// as the loads finish. The models share the registry's connection, string pool and
+// prepared statements for reads and the connection manager's writer for edits.
+
+class TreeRegistry : public QObject {
+    Q_OBJECT
+
+public:
+    TreeRegistry(const QSqlDatabase& db, ConnectionManager* connections, QObject* parent = nullptr);
+    ~TreeRegistry();
+
+    void Load(const QList<TreeInfo>& tree_infos);
+    // Rereads a loaded tree on a worker and resets its model with the result.
+    QFuture<bool> Reload(const QString& node);
+
+    TreeModel* Model(const QString& node) const;
+    QList<TreeModel*> Models() const;
+    StringInterner* Interner();
+
+signals:
+    void TreeLoaded(TreeModel* model);
+
+private:
+    QFutureWatcher<TreeData>* Watch(const TreeInfo& tree_info, int depth);
+    void Adopt(const TreeInfo& tree_info, TreeData data);
+
+private:
+    QSqlDatabase db;
+    ConnectionManager* connections { nullptr };
+
+    StringInterner interner;
+    StatementCache statements;
+
+    QMap<QString, TreeModel*> models;
+    QList<QFutureWatcher<TreeData>*> watchers;
+};
+
+#endif // TREEREGISTRY_H
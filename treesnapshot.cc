@@ -0,0 +1,151 @@
+#include "treesnapshot.h"
+#include <QDebug>
+#include <QFile>
+#include <QSaveFile>
+
+namespace {
+const quint32 kMagic = 0x45455254; // "TREE"
+const quint32 kFormat = 2;
+
+struct Header {
+    quint32 magic;
+    quint32 format;
+    qint64 version;
+    quint32 node_count;
+    quint32 pool_size;
+    quint64 checksum;
+};
+
+struct NodeRecord {
+    qint32 id;
+    qint32 parent;
+    quint32 name_offset;
+    quint32 name_size;
+    quint32 description_offset;
+    quint32 description_size;
+};
+
+// FNV-1a, 64 bit
+quint64 Checksum(const uchar* data, qint64 size)
+{
+    quint64 hash = 14695981039346656037ULL;
+
+    for (qint64 i = 0; i != size; ++i) {
+        hash ^= data[i];
+        hash *= 1099511628211ULL;
+    }
+
+    return hash;
+}
+}
+
+bool TreeSnapshot::Write(const QString& file_name, qint64 version, const Node* root)
+{
+    QVector<NodeRecord> nodes;
+    QString pool;
+
+    auto Append = [&pool](const QString& string, quint32& offset, quint32& size) {
+        offset = pool.size();
+        size = string.size();
+        pool += string;
+    };
+
+    std::function<void(const Node*, qint32)> Flatten = [&](const Node* node, qint32 parent) {
+        for (const Node* child : node->children) {
+            NodeRecord record {};
+            record.id = child->id;
+            record.parent = parent;
+            Append(child->name, record.name_offset, record.name_size);
+            Append(child->description, record.description_offset, record.description_size);
+
+            nodes.append(record);
+            Flatten(child, nodes.size() - 1);
+        }
+    };
+
+    Flatten(root, -1);
+
+    QByteArray payload;
+    payload.reserve(nodes.size() * sizeof(NodeRecord) + pool.size() * sizeof(QChar));
+    payload.append(reinterpret_cast<const char*>(nodes.constData()), nodes.size() * sizeof(NodeRecord));
+    payload.append(reinterpret_cast<const char*>(pool.constData()), pool.size() * sizeof(QChar));
+
+    Header header {};
+    header.magic = kMagic;
+    header.format = kFormat;
+    header.version = version;
+    header.node_count = nodes.size();
+    header.pool_size = pool.size();
+    header.checksum = Checksum(reinterpret_cast<const uchar*>(payload.constData()), payload.size());
+
+    QSaveFile file(file_name);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning() << "Failed to write snapshot" << file_name << file.errorString();
+        return false;
+    }
+
+    file.write(reinterpret_cast<const char*>(&header), sizeof(Header));
+    file.write(payload);
+
+    return file.commit();
+}
+
+Node* TreeSnapshot::Read(const QString& file_name, qint64 version)
+{
+    QFile file(file_name);
+    if (!file.open(QIODevice::ReadOnly) || file.size() < qint64(sizeof(Header)))
+        return nullptr;
+
+    uchar* data = file.map(0, file.size());
+    if (!data)
+        return nullptr;
+
+    Header header;
+    memcpy(&header, data, sizeof(Header));
+
+    qint64 size = sizeof(Header)
+        + qint64(header.node_count) * sizeof(NodeRecord)
+        + qint64(header.pool_size) * sizeof(QChar);
+
+    if (header.magic != kMagic || header.format != kFormat || header.version != version || file.size() != size
+        || Checksum(data + sizeof(Header), size - sizeof(Header)) != header.checksum) {
+        file.unmap(data);
+        return nullptr;
+    }
+
+    const auto* nodes = reinterpret_cast<const NodeRecord*>(data + sizeof(Header));
+    const auto* pool = reinterpret_cast<const QChar*>(nodes + header.node_count);
+
+    auto String = [pool, &header](quint32 offset, quint32 size) {
+        if (qint64(offset) + size > header.pool_size)
+            return QString();
+
+        return QString(pool + offset, size);
+    };
+
+    auto* root = new Node(-1, "root", "");
+    QVector<Node*> flat(header.node_count);
+
+    for (quint32 i = 0; i != header.node_count; ++i) {
+        const NodeRecord& record = nodes[i];
+
+        if (record.parent >= qint32(i)) {
+            qWarning() << "Snapshot is corrupt" << file_name;
+            delete root;
+            file.unmap(data);
+            return nullptr;
+        }
+
+        auto* node = new Node(record.id,
+            String(record.name_offset, record.name_size),
+            String(record.description_offset, record.description_size));
+        Node* parent = record.parent < 0 ? root : flat.at(record.parent);
+
+        node->parent = parent;
+        parent->children.append(node);
+        flat[i] = node;
+    }
+
+    file.unmap(data);
+    return root;
+}
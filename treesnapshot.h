@@ -0,0 +1,18 @@
+#ifndef TREESNAPSHOT_H
+#define TREESNAPSHOT_H
+
+#include "tree.h"
+
+// Binary image of a tree written next to the database. Layout:
+// header | node records in pre-order (parent index, -1 for top level) | UTF-16 string pool
+// Leaf paths are not stored, they are derived from the graph and the string pool on load.
+// The header carries the tree_version the image was taken at and a checksum of everything after it,
+// Read() maps the file and rejects it when either does not match.
+
+class TreeSnapshot {
+public:
+    static bool Write(const QString& file_name, qint64 version, const Node* root);
+    static Node* Read(const QString& file_name, qint64 version);
+};
+
+#endif // TREESNAPSHOT_H
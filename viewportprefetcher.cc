@@ -0,0 +1,82 @@
+#include "viewportprefetcher.h"
+#include <QAbstractItemView>
+#include <QScrollBar>
+#include <QTimer>
+#include <QTreeView>
+
+ViewportPrefetcher::ViewportPrefetcher(QAbstractItemView* view, int margin)
+    : QObject { view }
+    , view { view }
+    , timer { new QTimer(this) }
+    , margin { margin }
+{
+    timer->setSingleShot(true);
+    timer->setInterval(0);
+    connect(timer, &QTimer::timeout, this, &ViewportPrefetcher::Prefetch);
+
+    connect(view->verticalScrollBar(), &QScrollBar::valueChanged, this, &ViewportPrefetcher::Schedule);
+    connect(view->verticalScrollBar(), &QScrollBar::rangeChanged, this, &ViewportPrefetcher::Schedule);
+
+    if (auto* tree_view = qobject_cast<QTreeView*>(view)) {
+        connect(tree_view, &QTreeView::expanded, this, &ViewportPrefetcher::Schedule);
+        connect(tree_view, &QTreeView::collapsed, this, &ViewportPrefetcher::Schedule);
+    }
+
+    Watch();
+}
+
+void ViewportPrefetcher::Watch()
+{
+    auto* model = view->model();
+    if (!model)
+        return;
+
+    connect(model, &QAbstractItemModel::modelReset, this, &ViewportPrefetcher::Schedule, Qt::UniqueConnection);
+    connect(model, &QAbstractItemModel::layoutChanged, this, &ViewportPrefetcher::Schedule, Qt::UniqueConnection);
+    connect(model, &QAbstractItemModel::dataChanged, this, &ViewportPrefetcher::Schedule, Qt::UniqueConnection);
+
+    Schedule();
+}
+
+void ViewportPrefetcher::Schedule()
+{
+    timer->start();
+}
+
+void ViewportPrefetcher::Prefetch()
+{
+    auto* model = view->model();
+    if (!model)
+        return;
+
+    QModelIndex first = view->indexAt(QPoint(1, 1));
+    if (!first.isValid())
+        return;
+
+    auto* tree_view = qobject_cast<QTreeView*>(view);
+
+    auto Above = [tree_view](const QModelIndex& index) {
+        return tree_view ? tree_view->indexAbove(index) : index.siblingAtRow(index.row() - 1);
+    };
+    auto Below = [tree_view](const QModelIndex& index) {
+        return tree_view ? tree_view->indexBelow(index) : index.siblingAtRow(index.row() + 1);
+    };
+
+    int height = qMax(1, view->visualRect(first).height());
+    int visible = view->viewport()->height() / height + 1;
+
+    QModelIndex index = first;
+    for (int i = 0; i != margin; ++i) {
+        QModelIndex above = Above(index);
+        if (!above.isValid())
+            break;
+
+        index = above;
+    }
+
+    // One role of one column formats the whole row.
+    for (int i = 0; index.isValid() && i != visible + 2 * margin; ++i) {
+        index.data(Qt::DisplayRole);
+        index = Below(index);
+    }
+}
@@ -0,0 +1,30 @@
+#ifndef VIEWPORTPREFETCHER_H
+#define VIEWPORTPREFETCHER_H
+
+#include <QObject>
+
+class QAbstractItemView;
+class QTimer;
+
+// Requests the visible rows of a view plus a margin above and below once the view settles
+// after a scroll, resize, expand or model change, so the model's format cache is warm
+// before the rows are painted.
+
+class ViewportPrefetcher : public QObject {
+    Q_OBJECT
+
+public:
+    explicit ViewportPrefetcher(QAbstractItemView* view, int margin = 64);
+
+private:
+    void Schedule();
+    void Prefetch();
+    void Watch();
+
+private:
+    QAbstractItemView* view;
+    QTimer* timer;
+    int margin;
+};
+
+#endif // VIEWPORTPREFETCHER_H